@@ -0,0 +1,64 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+// producers bumping one shared std::atomic vs a sharded_counter,
+// then task_runner::send throughput which counts waiting tasks with the latter
+
+#include "sharded_counter.h"
+#include "task_runner.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cassert>
+
+using bench_clock = std::chrono::steady_clock;
+
+template<typename F>
+double ns_per_op(size_t n_threads, size_t n_ops, F f) {
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n_threads; i++)
+        threads.emplace_back([&]() {
+            while (!go) { }
+            for (size_t k = 0; k < n_ops; k++)
+                f();
+        });
+    auto t0 = bench_clock::now();
+    go = true;
+    for (auto & t : threads)
+        t.join();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - t0).count();
+    return static_cast<double>(ns) / static_cast<double>(n_threads * n_ops);
+}
+
+int main() {
+    const size_t n_ops = 1000000;
+    // at least 4 producers so the table means something on small machines too
+    size_t max_threads = std::thread::hardware_concurrency();
+    if (max_threads < 4)
+        max_threads = 4;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "producers  atomic ns/op  sharded ns/op  task_runner send ns/op\n";
+    for (size_t n = 1; n <= max_threads; n *= 2) {
+        std::atomic<size_t> plain(0);
+        double a = ns_per_op(n, n_ops, [&plain]() { plain.fetch_add(1, std::memory_order_relaxed); });
+        assert(plain == n * n_ops);
+
+        sharded_counter sharded;
+        double s = ns_per_op(n, n_ops, [&sharded]() { ++sharded; });
+        assert(sharded.exact() == static_cast<int64_t>(n * n_ops));
+
+        double r;
+        {
+            task_runner tr(task_runner::stop_mode::WAIT_ALL_DONE);
+            tr.start();
+            r = ns_per_op(n, n_ops / 10, [&tr]() { tr.send([]() {}); });
+            tr.stop();
+            assert(tr.waiting_tasks() == 0);
+        }
+        std::cout << std::setw(9) << n << std::setw(14) << a << std::setw(15) << s << std::setw(24) << r << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+// queueing latency (send to start) of task_group with skewed task durations,
+// 1 in 50 tasks blocks for 20ms (I/O like, so it also shows on few cores), the rest 100us,
+// with and without stealing
+
+#include "task_group.h"
+#include "wait_group.h"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+static void measure(const char* name, bool steal) {
+    const int n_tasks = 2000;
+    std::vector<long> latency(n_tasks);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick(0, 49);
+
+    task_group tg(4, task_group::stop_mode::WAIT_CURRENT_DONE);
+    if (steal)
+        tg.enable_stealing();
+    tg.start();
+    wait_group wg;
+    for (int i = 0; i < n_tasks; i++) {
+        auto sent = task_runner::now();
+        auto busy = std::chrono::microseconds(pick(rng) == 0 ? 20000 : 100);
+        tg.send(wg.wrap([&latency, i, sent, busy]() {
+            latency[i] = static_cast<long>((task_runner::now() - sent).count());
+            std::this_thread::sleep_for(busy);
+        }));
+        // arrivals a bit slower than the group drains them on average
+        std::this_thread::sleep_for(std::chrono::microseconds(250));
+    }
+    wg.wait();
+    tg.stop();
+
+    std::sort(latency.begin(), latency.end());
+    auto pct = [&latency](double p) {
+        return latency[static_cast<size_t>(p * static_cast<double>(latency.size() - 1))];
+    };
+    std::cout << std::setw(16) << name << std::setw(9) << pct(0.5) << std::setw(9) << pct(0.9)
+              << std::setw(9) << pct(0.99) << std::setw(9) << latency.back()
+              << std::setw(9) << tg.stolen_tasks() << "\n";
+}
+
+int main() {
+    std::cout << std::setw(16) << "latency (us)" << std::setw(9) << "p50" << std::setw(9) << "p90"
+              << std::setw(9) << "p99" << std::setw(9) << "max" << std::setw(9) << "stolen" << "\n";
+    measure("round-robin", false);
+    measure("stealing", true);
+    return 0;
+}
@@ -0,0 +1,63 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+// evt_runner::send cost per call as producers are added, every event also fires
+// (includes draining and dispatch on the loop thread, which runs alongside);
+// total throughput and its gain over one producer show the scaling, which needs
+// at least producers + 1 cores, rows beyond that only time-slice the same cores
+
+#include "evt_runner.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cassert>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ns_per_send(size_t n_threads, size_t n_ops) {
+    evt_runner<size_t> runner;
+    std::atomic<size_t> fired(0);
+    runner.register_event(0, [&fired](const size_t&) { fired.fetch_add(1, std::memory_order_relaxed); });
+    runner.start();
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n_threads; i++)
+        threads.emplace_back([&]() {
+            while (!go) { }
+            for (size_t k = 0; k < n_ops; k++)
+                runner.send(0, k);
+        });
+    auto t0 = bench_clock::now();
+    go = true;
+    for (auto & t : threads)
+        t.join();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - t0).count();
+    while (fired < n_threads * n_ops)
+        std::this_thread::yield();
+    runner.stop();
+    return static_cast<double>(ns) / static_cast<double>(n_threads * n_ops);
+}
+
+int main() {
+    const size_t n_ops = 200000;
+    // at least 4 producers so the table means something on small machines too
+    size_t max_threads = std::thread::hardware_concurrency();
+    if (max_threads < 4)
+        max_threads = 4;
+
+    size_t cores = std::thread::hardware_concurrency();
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "cores: " << cores << "\n";
+    std::cout << "producers  send ns/op  Mposts/s  vs 1 producer\n";
+    double base = 0;
+    for (size_t n = 1; n <= max_threads; n *= 2) {
+        double ns = ns_per_send(n, n_ops);
+        double mops = 1e3 / ns;
+        if (n == 1)
+            base = mops;
+        std::cout << std::setw(9) << n << std::setw(12) << ns << std::setw(10) << mops
+                  << std::setw(14) << mops / base << (cores != 0 && n + 1 > cores ? "  (oversubscribed)" : "") << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+// how late task_runner runs deferred tasks in each timer mode,
+// tasks are pushed one at a time 1-5ms ahead while the loop is otherwise idle
+
+#include "task_runner.h"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <future>
+
+static void measure(const char* name, task_runner::timer_mode tm, std::chrono::microseconds spin) {
+    const int n_samples = 300;
+    std::vector<long> lateness;
+    lateness.reserve(n_samples);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> ahead_us(1000, 5000);
+
+    task_runner tr(task_runner::stop_mode::IMMEDIATE, tm, spin);
+    tr.start();
+    for (int i = 0; i < n_samples; i++) {
+        auto ts = task_runner::now() + std::chrono::microseconds(ahead_us(rng));
+        std::promise<long> done;
+        auto f = done.get_future();
+        tr.push([ts, &done]() {
+            done.set_value(static_cast<long>((task_runner::now() - ts).count()));
+        }, ts);
+        lateness.push_back(f.get());
+    }
+    tr.stop();
+
+    std::sort(lateness.begin(), lateness.end());
+    auto pct = [&lateness](double p) {
+        return lateness[static_cast<size_t>(p * static_cast<double>(lateness.size() - 1))];
+    };
+    std::cout << std::setw(22) << name << std::setw(8) << pct(0.5) << std::setw(8) << pct(0.9)
+              << std::setw(8) << pct(0.99) << std::setw(8) << lateness.back() << "\n";
+}
+
+int main() {
+    std::cout << std::setw(22) << "lateness (us)" << std::setw(8) << "p50" << std::setw(8) << "p90"
+              << std::setw(8) << "p99" << std::setw(8) << "max" << "\n";
+    measure("condvar", task_runner::timer_mode::CONDVAR, std::chrono::microseconds(0));
+    measure("condvar + 50us spin", task_runner::timer_mode::CONDVAR, std::chrono::microseconds(50));
+#ifdef __linux__
+    measure("timerfd", task_runner::timer_mode::PRECISE, std::chrono::microseconds(0));
+    measure("timerfd + 50us spin", task_runner::timer_mode::PRECISE, std::chrono::microseconds(50));
+#endif
+    return 0;
+}
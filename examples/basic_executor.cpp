@@ -0,0 +1,88 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#include "basic_executor.h"
+#include <iostream>
+#include <cassert>
+
+int main() {
+    {
+        // single thread, wait-free intake, like task_runner
+        serial_executor ex;
+        ex.execute([](){ std::cout << "serial: immediate\n"; });
+        ex.execute_after(std::chrono::milliseconds(50), [](){ std::cout << "serial: after 50ms\n"; });
+        auto f = ex.submit([](int a, int b){ return a + b; }, 1, 2);
+        assert(f.get() == 3);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        assert(ex.pending() == 0);
+    }
+
+    {
+        // pool with futex parking and move-only tasks
+        basic_executor<mutex_queue, futex_wait, move_only_task> ex(4);
+        struct answer {
+            std::unique_ptr<int> p;
+            std::promise<int>* pr;
+            void operator()() { pr->set_value(*p); }
+        };
+        std::promise<int> pr;
+        auto f = pr.get_future();
+        ex.execute(answer{std::unique_ptr<int>(new int(42)), &pr});
+        int v = f.get();
+        assert(v == 42);
+        std::cout << "move-only task got " << v << "\n";
+    }
+
+    {
+        // busy polling pool over a lock-free ring, no timers
+        spin_pool_executor ex(2);
+        std::atomic<int> n(0);
+        for (int i = 0; i < 10000; i++)
+            ex.execute([&n](){ ++n; });
+        ex.stop();  // drains by default
+        assert(n == 10000);
+        std::cout << "spin pool ran " << n << " tasks\n";
+    }
+
+    {
+        // timed tasks still pending at stop(DRAIN) run right away
+        pool_executor ex(2);
+        std::atomic<int> n(0);
+        ex.execute_after(std::chrono::seconds(10), [&n](){ ++n; });
+        assert(ex.pending() == 1);
+        ex.stop(pool_executor::stop_mode::DRAIN);
+        assert(n == 1);
+        std::cout << "drained timed task\n";
+    }
+
+    {
+        // workers keep their own children, idle ones steal the oldest of a busy sibling
+        stealing_pool_executor ex(4);
+        std::atomic<int> n(0);
+        for (int i = 0; i < 8; i++)
+            ex.execute([&ex, &n](){
+                for (int j = 0; j < 100; j++)
+                    ex.execute([&n](){ ++n; });
+            });
+        ex.stop();
+        assert(n == 800);
+        std::cout << "stealing pool ran " << n << " children\n";
+    }
+
+    {
+        // a timer added while every worker sleeps moves the wakeup earlier
+        serial_executor ex;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::promise<void> fired;
+        auto start = serial_executor::clock::now();
+        ex.execute_after(std::chrono::milliseconds(50), [&fired](){ fired.set_value(); });
+        auto status = fired.get_future().wait_for(std::chrono::milliseconds(500));
+        assert(status == std::future_status::ready);
+        std::cout << "timer fired after "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(serial_executor::clock::now() - start).count()
+                  << "ms\n";
+    }
+
+    return 0;
+}
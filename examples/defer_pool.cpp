@@ -5,6 +5,12 @@
 #include "defer_pool.h"
 #include <iostream>
 #include <string>
+#include <cassert>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <stdexcept>
 
 void f(int x) {
     std::cout << "call f with x = " << x << "\n";
@@ -82,5 +88,101 @@ int main(int argc, char **argv) {
 
     std::cout << std::endl;
 
+    // task still queued at its deadline is dropped instead of run
+    p.push([](){ std::this_thread::sleep_for(std::chrono::milliseconds(100)); });
+    auto f3 = p.push_with_deadline(defer_pool::clock::now() + std::chrono::milliseconds(10),
+                                   [](int x){ return x; }, 3);
+    try {
+        f3.get();
+    }
+    catch (task_expired & e) {
+        std::cout << "deadline task dropped: " << e.what()
+                  << ", expired tasks: " << p.expired_tasks() << "\n";
+    }
+
+    // nested fork-join deeper than the pool size, waiting workers run queued children
+    std::function<long(int)> fib = [&p, &fib](int n) -> long {
+        if (n < 2)
+            return n;
+        auto left = p.push(fib, n - 1);
+        long right = fib(n - 2);
+        return p.get(left) + right;
+    };
+    auto f4 = p.push(fib, 20);
+    long r = f4.get();
+    assert(r == 6765);
+    std::cout << "fib(20) on " << p.size() << " thread: " << r << "\n";
+
+    // a worker waiting for a future that nothing in the pool completes, here a promise
+    // set by an outside thread, still sees it ready without any further push
+    {
+        defer_pool single(1);
+        std::promise<int> promise;
+        std::future<int> outside = promise.get_future();
+        auto waiter = single.push([&single, &outside]() { return single.get(outside); });
+        std::thread setter([&promise]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            promise.set_value(7);
+        });
+        bool woke = waiter.wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+        setter.join();
+        assert(woke && waiter.get() == 7);
+        std::cout << "wait on an outside promise: done\n";
+    }
+
+    // 50 callers asking for the same key at once share one run
+    std::atomic<int> fills(0);
+    std::vector<std::shared_future<int>> fs;
+    for (int i = 0; i < 50; i++)
+        fs.push_back(p.push_once("user:42", [&fills](){
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ++fills;
+            return 42;
+        }));
+    for (auto & sf : fs)
+        assert(sf.get() == 42);
+    std::cout << "push_once: " << fills << " run for " << fs.size() << " callers, "
+              << p.deduplicated_tasks() << " deduplicated\n";
+
+    // joining a key in flight with another result type is an error, not a wrong cast
+    {
+        std::promise<void> gate;
+        std::shared_future<void> open = gate.get_future().share();
+        auto first = p.push_once("user:43", [open](){ open.wait(); return 43; });
+        bool thrown = false;
+        try {
+            p.push_once("user:43", [](){ return std::string("43"); });
+        } catch (const std::logic_error&) {
+            thrown = true;
+        }
+        gate.set_value();
+        assert(thrown && first.get() == 43);
+        std::cout << "push_once: mismatched result type rejected\n";
+    }
+
+    // blocked tasks hand their core to a spare worker, the short ones do not queue behind them
+    p.resize(2);
+    auto start = defer_pool::clock::now();
+    std::vector<std::future<void>> blocked;
+    for (int i = 0; i < 2; i++)
+        blocked.push_back(p.push([](){
+            defer_pool::blocking_scope _;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::cout << "spare threads while blocked: " << p.spare_threads() << "\n";
+    std::vector<std::future<int>> quick;
+    for (int i = 0; i < 10; i++)
+        quick.push_back(p.push([](int x){ return x; }, i));
+    for (auto & q : quick)
+        q.get();
+    std::cout << "quick tasks done after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(defer_pool::clock::now() - start).count()
+              << "ms\n";
+    for (auto & b : blocked)
+        b.get();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::cout << "spare threads after: " << p.spare_threads() << "\n";
+
     return 0;
 }
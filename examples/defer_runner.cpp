@@ -6,6 +6,7 @@
 #include <cassert>
 #include <iostream>
 #include <chrono>
+#include <stdexcept>
 
 int main() {
     defer_runner dr;
@@ -31,5 +32,17 @@ int main() {
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
 
+    // no future, exceptions of executed tasks go to the handler
+    dr.set_exception_handler([](std::exception_ptr e) {
+        try {
+            std::rethrow_exception(e);
+        } catch (std::exception & ex) {
+            std::cout << "handler caught: " << ex.what() << "\n";
+        }
+    });
+    dr.execute([](int x){ std::cout << "executed: " << x << "\n"; }, 3);
+    dr.execute([](){ throw std::runtime_error("fire and forget failed"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
     return 0;
 }
@@ -4,12 +4,26 @@
 
 #include "evt_runner.h"
 #include <iostream>
+#include <atomic>
+#include <cassert>
+#include <thread>
 
 struct event {
     evt_runner<event>& runner;
     static const int id = 0;
 };
 
+// counts what happens to a payload on its way to the callbacks
+struct counted {
+    static std::atomic<int> copies, moves, alive;
+    explicit counted(int v) : value(v) { ++alive; }
+    counted(const counted& o) : value(o.value) { ++copies; ++alive; }
+    counted(counted&& o) : value(o.value) { ++moves; ++alive; }
+    ~counted() { --alive; }
+    int value;
+};
+std::atomic<int> counted::copies(0), counted::moves(0), counted::alive(0);
+
 int main() {
     evt_runner<event> runner;
     runner.register_event(event::id, [](const event& evt) {
@@ -67,5 +81,148 @@ int main() {
               << "ms"
               << std::endl;
 
+    std::cout << "-------------------------------------------" << std::endl;
+
+    // burst of posts merged into one dispatch with the latest payload
+    evt_runner<int> counter;
+    const int counter_id = 1;
+    counter.register_event(counter_id, [](const int& n) {
+        std::cout << "debounced burst, latest value: " << n << std::endl;
+    });
+    counter.set_coalesce(counter_id, evt_runner<int>::coalesce_policy::DEBOUNCE, 100);
+    counter.start();
+    for (int i = 0; i < 1000; i++)
+        counter.send(counter_id, i);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    counter.stop();
+
+    std::cout << "-------------------------------------------" << std::endl;
+
+    // move-only payload built in its event record and handed over by rvalue
+    using buffer = std::unique_ptr<std::vector<char>>;
+    evt_runner<buffer> buffers;
+    const int buffer_id = 2;
+    buffers.register_event(buffer_id, [](const buffer& b) {
+        std::cout << "peek buffer of size " << b->size() << std::endl;
+    });
+    buffers.register_consumer(buffer_id, [](buffer&& b) {
+        buffer owned(std::move(b));
+        std::cout << "consume buffer of size " << owned->size() << std::endl;
+    });
+    buffers.start();
+    buffers.post_emplace(buffer_id, new std::vector<char>(1 << 20));
+    buffers.send(buffer_id, buffer(new std::vector<char>(1 << 10)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    buffers.stop();
+
+    // post_emplace builds the payload in its record, send moves the argument in once
+    {
+        evt_runner<counted> runner;
+        std::atomic<int> seen(0);
+        runner.register_event(3, [&seen](const counted& c) { seen += c.value; });
+        runner.start();
+        runner.post_emplace(3, 1);
+        while (seen < 1)
+            std::this_thread::yield();
+        assert(counted::copies == 0 && counted::moves == 0);
+        runner.send(3, counted(2));
+        while (seen < 3)
+            std::this_thread::yield();
+        assert(counted::copies == 0 && counted::moves == 1);
+        // cancelled and never-run payloads are destroyed as well
+        runner.cancel(runner.post(3, counted(4), 1000));
+        runner.post(3, counted(8), 1000);
+        runner.stop();
+        assert(seen == 3 && counted::copies == 0 && counted::alive == 0);
+        std::cout << "payload copies " << counted::copies << ", moves " << counted::moves << std::endl;
+    }
+
+    std::cout << "-------------------------------------------" << std::endl;
+
+    // pending posts can be cancelled or moved through their handle
+    evt_runner<int> timers;
+    const int timeout_id = 3;
+    timers.register_event(timeout_id, [](const int& n) {
+        std::cout << "timeout " << n << " fired" << std::endl;
+    });
+    timers.start();
+    auto t1 = timers.post(timeout_id, 1, 50);
+    auto t2 = timers.post(timeout_id, 2, 1000);
+    timers.cancel(t1);
+    timers.reschedule(t2, 10);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (!timers.cancel(t2))
+        std::cout << "timeout 2 already fired, its handle is stale" << std::endl;
+    timers.stop();
+
+#ifdef __linux__
+    std::cout << "-------------------------------------------" << std::endl;
+
+    // reactor backend: fd readiness and timers on the same loop thread, no bridge thread
+    evt_runner<int> reactor(evt_runner<int>::backend::REACTOR);
+    int fds[2];
+    if (pipe(fds) == 0) {
+        reactor.register_fd(fds[0], EPOLLIN, [](int fd, uint32_t) {
+            char buf[64];
+            ssize_t n = read(fd, buf, sizeof(buf));
+            std::cout << "pipe readable, read " << n << " bytes" << std::endl;
+        });
+        reactor.register_event(timeout_id, [](const int& n) {
+            std::cout << "reactor timer " << n << " fired" << std::endl;
+        });
+        reactor.start();
+        reactor.post(timeout_id, 1, 20);
+        ssize_t written = write(fds[1], "ping", 4);
+        (void)written;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        reactor.stop();
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    // fds are still served while a steady stream of posts keeps the loop from sleeping
+    evt_runner<int> busy(evt_runner<int>::backend::REACTOR);
+    if (pipe(fds) == 0) {
+        std::atomic<bool> readable(false);
+        busy.register_fd(fds[0], EPOLLIN, [&readable](int fd, uint32_t) {
+            char buf[64];
+            ssize_t n = read(fd, buf, sizeof(buf));
+            (void)n;
+            readable = true;
+        });
+        std::atomic<size_t> handled(0);
+        busy.register_event(timeout_id, [&handled](const int&) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            ++handled;
+        });
+        busy.start();
+        std::atomic<bool> flooding(true);
+        std::thread sender([&]() {
+            // keep a backlog of up to 64 posts, never let the inboxes run dry
+            for (size_t sent = 0; flooding; ) {
+                if (sent - handled < 64) {
+                    busy.send(timeout_id, 0);
+                    ++sent;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ssize_t written = write(fds[1], "ping", 4);
+        (void)written;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (!readable && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        flooding = false;
+        sender.join();
+        busy.stop();
+        close(fds[0]);
+        close(fds[1]);
+        assert(readable && "fd starved by posts");
+        std::cout << "pipe served under a stream of posts" << std::endl;
+    }
+#endif
+
     return 0;
 }
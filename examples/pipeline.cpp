@@ -0,0 +1,76 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#include "pipeline.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <cassert>
+
+struct record {
+    int line;
+    std::string text;
+    size_t words;
+};
+
+int main() {
+    defer_pool pool(4);
+
+    // parse (serial, in order) -> count words (parallel) -> write (serial, in order)
+    std::istringstream input("the quick brown fox\njumps over\nthe lazy dog\n"
+                             "pipelines keep order\nwhere it matters\nand run in parallel elsewhere\n");
+    int n_lines = 0;
+    int last_written = -1;
+    pipeline<record> p(pool);
+    p.add_stage(pipeline<record>::stage_mode::PARALLEL, [](record& r) {
+        std::istringstream words(r.text);
+        std::string w;
+        r.words = 0;
+        while (words >> w)
+            ++r.words;
+    }).add_stage(pipeline<record>::stage_mode::SERIAL_IN_ORDER, [&last_written](record& r) {
+        assert(r.line == last_written + 1);
+        last_written = r.line;
+        std::cout << r.line << ": " << r.words << " words | " << r.text << "\n";
+    });
+    // at most 2 records alive at any time
+    p.run([&](record& r) {
+        if (!std::getline(input, r.text))
+            return false;
+        r.line = n_lines++;
+        return true;
+    }, 2);
+    assert(last_written == n_lines - 1);
+
+    // many items, few tokens
+    long sum = 0;
+    int next = 0;
+    pipeline<long> squares(pool);
+    squares.add_stage(pipeline<long>::stage_mode::PARALLEL, [](long& x) { x *= x; })
+           .add_stage(pipeline<long>::stage_mode::SERIAL_OUT_OF_ORDER, [&sum](long& x) { sum += x; });
+    squares.run([&next](long& x) {
+        if (next == 1000)
+            return false;
+        x = next++;
+        return true;
+    }, 8);
+    assert(sum == 332833500);
+    std::cout << "sum of squares below 1000: " << sum << "\n";
+
+    // first exception stops the input and is rethrown by run()
+    pipeline<int> failing(pool);
+    failing.add_stage(pipeline<int>::stage_mode::PARALLEL, [](int& x) {
+        if (x == 5)
+            throw std::runtime_error("bad item 5");
+    });
+    int k = 0;
+    try {
+        failing.run([&k](int& x) { x = k++; return true; }, 4);
+    } catch (std::exception & e) {
+        std::cout << "pipeline stopped: " << e.what() << "\n";
+    }
+
+    return 0;
+}
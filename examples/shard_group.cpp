@@ -0,0 +1,69 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#include "shard_group.h"
+#include "wait_group.h"
+#include <iostream>
+#include <cassert>
+
+// each shard owns its slice of the counters, nobody else touches them
+struct counters {
+    explicit counters(size_t n) : per_shard(n, 0) {}
+    std::vector<long> per_shard;
+};
+
+int main() {
+    shard_group sg(4, 64);
+    assert(sg.size() == 4);
+    assert(sg.this_shard() == -1);
+    sg.start();
+
+    // from outside: one message per shard
+    {
+        wait_group wg;
+        for (size_t i = 0; i < sg.size(); i++)
+            sg.submit_to(i, wg.wrap([&sg, i]() {
+                assert(sg.this_shard() == static_cast<int>(i));
+            }));
+        wg.wait();
+        std::cout << "hello from every shard\n";
+    }
+
+    // hop a token around the ring of shards, every hop is a cross-shard message
+    {
+        wait_group wg(1);
+        std::function<void(int)> hop;
+        hop = [&](int left) {
+            if (left == 0) {
+                wg.done();
+                return;
+            }
+            size_t next = (sg.this_shard() + 1) % sg.size();
+            sg.submit_to(next, hop, left - 1);
+        };
+        sg.submit_to(0, hop, 10000);
+        wg.wait();
+        std::cout << "token made 10000 hops\n";
+    }
+
+    // all-to-all burst larger than the rings, senders overflow and flush later
+    {
+        counters c(sg.size());
+        wait_group wg;
+        const int per_pair = 1000;
+        for (size_t from = 0; from < sg.size(); from++)
+            sg.submit_to(from, wg.wrap([&, from]() {
+                for (size_t to = 0; to < sg.size(); to++)
+                    for (int k = 0; k < per_pair; k++)
+                        sg.submit_to(to, wg.wrap([&c, to]() { ++c.per_shard[to]; }));
+            }));
+        wg.wait();
+        for (size_t i = 0; i < sg.size(); i++)
+            assert(c.per_shard[i] == static_cast<long>(per_pair * sg.size()));
+        std::cout << "all-to-all done: " << per_pair * sg.size() * sg.size() << " messages\n";
+    }
+
+    sg.stop();
+    return 0;
+}
@@ -4,6 +4,7 @@
 
 #include "task_group.h"
 #include <iostream>
+#include <cassert>
 
 void f(int x) {
     std::cout << "call f with x = " << x << "\n";
@@ -42,6 +43,20 @@ int main() {
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
 
+    {
+        // key 7 limited to 20 tasks per second, bursts of 3
+        tg.set_rate_limit(7, 20, 3);
+        auto start = task_runner::now();
+        for (int i = 0; i < 6; i++)
+            tg.send_limited(7, [start](int i){
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(task_runner::now() - start).count();
+                std::cout << "limited task " << i << " at " << ms << " ms\n";
+            }, i);
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        std::cout << "throttled: " << tg.throttled_tasks() << "\n";
+        tg.remove_rate_limit(7);
+    }
+
     tg.stop();
 
     tg.start();
@@ -50,5 +65,21 @@ int main() {
         std::cout << "restart here: " << x << std::endl;
     }, task_runner::now(), 2);
 
+    {
+        // a slow task does not hold up the quick ones queued behind it
+        task_group stealing(2);
+        stealing.enable_stealing();
+        stealing.start();
+        auto start = task_runner::now();
+        for (int i = 0; i < 4; i++)
+            stealing.send([start](int i){
+                std::this_thread::sleep_for(std::chrono::milliseconds(i == 0 ? 200 : 10));
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(task_runner::now() - start).count();
+                std::cout << "task " << i << " done at " << ms << " ms\n";
+            }, i);
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        std::cout << "stolen: " << stealing.stolen_tasks() << "\n";
+    }
+
     return 0;
 }
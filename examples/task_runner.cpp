@@ -4,6 +4,9 @@
 
 #include "task_runner.h"
 #include <iostream>
+#include <cassert>
+#include <atomic>
+#include <stdexcept>
 
 void f(int x) {
     std::cout << "call f with x = " << x << "\n";
@@ -48,5 +51,82 @@ int main() {
         std::cout << "restart here: " << x << std::endl;
     }, task_runner::now(), 2);
 
+    // tasks handing work back to their own runner skip the queue
+    tr.send([&tr](){
+        tr.dispatch([](){
+            std::cout << "dispatched inline from the loop thread\n";
+        });
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // 1000 timers spread over 10ms, with 5ms slack they fire in a few batches
+    for (auto slack : {std::chrono::microseconds(0), std::chrono::microseconds(5000)}) {
+        size_t before = tr.wakeups();
+        auto start = task_runner::now() + std::chrono::milliseconds(5);
+        for (int i = 0; i < 1000; i++)
+            tr.push_slack([](){}, start + std::chrono::microseconds(i * 10), slack);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::cout << "slack " << slack.count() << "us: " << tr.wakeups() - before << " wakeups\n";
+    }
+
+    // stop modes since task_runner sits on basic_executor
+    {
+        // IMMEDIATE: the running task finishes, every queued one stays for the next start(),
+        // even those the loop already had in hand (they used to be dropped)
+        task_runner ir(task_runner::stop_mode::IMMEDIATE);
+        std::atomic<bool> started(false);
+        std::atomic<int> ran(0);
+        ir.send([&started]() {
+            started = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        });
+        for (int i = 0; i < 5; i++)
+            ir.send([&ran]() { ++ran; });
+        ir.start();
+        while (!started)
+            std::this_thread::yield();
+        ir.stop();
+        assert(ran == 0 && ir.waiting_tasks() == 5);
+        ir.start();
+        while (ran < 5)
+            std::this_thread::yield();
+        std::cout << "IMMEDIATE kept " << ran << " queued tasks for restart\n";
+    }
+    {
+        // WAIT_CURRENT_DONE: every queued task runs, so do tasks they queue while stopping,
+        // deferred ones stay
+        task_runner cr(task_runner::stop_mode::WAIT_CURRENT_DONE);
+        std::atomic<int> ran(0);
+        cr.start();
+        cr.push([&ran]() { ++ran; }, task_runner::now() + std::chrono::seconds(10));
+        cr.send([]() { std::this_thread::sleep_for(std::chrono::milliseconds(10)); });
+        cr.send([&cr, &ran]() {
+            ++ran;
+            cr.send([&ran]() { ++ran; });
+        });
+        cr.stop();
+        assert(ran == 2 && cr.waiting_tasks() == 1);
+        std::cout << "WAIT_CURRENT_DONE ran " << ran << " tasks, 1 deferred left\n";
+    }
+    {
+        // an exception escaping a task goes to the handler and the loop goes on;
+        // without a handler it is rethrown on the loop thread and terminates, as before
+        task_runner er(task_runner::stop_mode::WAIT_ALL_DONE);
+        std::atomic<int> caught(0), ran(0);
+        er.set_exception_handler([&caught](std::exception_ptr e) {
+            try {
+                std::rethrow_exception(e);
+            } catch (const std::runtime_error&) {
+                ++caught;
+            }
+        });
+        er.start();
+        er.send([]() { throw std::runtime_error("task failed"); });
+        er.send([&ran]() { ++ran; });
+        er.stop();
+        assert(caught == 1 && ran == 1);
+        std::cout << "exception handed to the handler, loop kept running\n";
+    }
+
     return 0;
 }
@@ -0,0 +1,175 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+// built with DISPATCHER_TRACE (see CMakeLists.txt): records a few dispatchers,
+// dumps the chrome trace json and checks it parses
+
+#include "defer_pool.h"
+#include "evt_runner.h"
+#include "task_runner.h"
+#include "trace.h"
+#include <cassert>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+// just enough of a json parser to tell whether the dump is well formed
+class json_checker {
+public:
+    explicit json_checker(const std::string& s) : s_(s), i_(0) {}
+    bool check() { return value() && (skip(), i_ == s_.size()); }
+
+private:
+    void skip() {
+        while (i_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[i_])))
+            i_++;
+    }
+    bool eat(char c) {
+        skip();
+        if (i_ < s_.size() && s_[i_] == c) {
+            i_++;
+            return true;
+        }
+        return false;
+    }
+    bool value() {
+        skip();
+        if (i_ >= s_.size())
+            return false;
+        char c = s_[i_];
+        if (c == '{')
+            return object();
+        if (c == '[')
+            return array();
+        if (c == '"')
+            return string();
+        return number();
+    }
+    bool object() {
+        eat('{');
+        if (eat('}'))
+            return true;
+        do {
+            skip();
+            if (!string() || !eat(':') || !value())
+                return false;
+        } while (eat(','));
+        return eat('}');
+    }
+    bool array() {
+        eat('[');
+        if (eat(']'))
+            return true;
+        do {
+            if (!value())
+                return false;
+        } while (eat(','));
+        return eat(']');
+    }
+    bool string() {
+        if (i_ >= s_.size() || s_[i_] != '"')
+            return false;
+        for (i_++; i_ < s_.size(); i_++) {
+            if (s_[i_] == '\\')
+                i_++;
+            else if (s_[i_] == '"')
+                return ++i_, true;
+        }
+        return false;
+    }
+    bool number() {
+        size_t begin = i_;
+        while (i_ < s_.size() && (std::isdigit(static_cast<unsigned char>(s_[i_])) ||
+                                  s_[i_] == '-' || s_[i_] == '+' || s_[i_] == '.' || s_[i_] == 'e' || s_[i_] == 'E'))
+            i_++;
+        return i_ > begin;
+    }
+
+    const std::string& s_;
+    size_t i_;
+};
+
+// task ids of the events of kind that started running
+static std::multiset<std::string> started(const std::string& json, const std::string& kind) {
+    std::multiset<std::string> ids;
+    std::istringstream lines(json);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.find("\"ph\":\"B\"") == std::string::npos ||
+            line.find("\"cat\":\"" + kind + "\"") == std::string::npos)
+            continue;
+        auto at = line.find("\"task\":\"") + 8;
+        ids.insert(line.substr(at, line.find('"', at) - at));
+    }
+    return ids;
+}
+
+int main(int argc, char **argv) {
+    tracer::enable(true);
+
+    // children pushed by a worker land in its local deque, the idle worker steals them
+    {
+        defer_pool pool(2);
+        auto parent = pool.push([&pool]() {
+            std::vector<std::future<void>> children;
+            for (int i = 0; i < 50; i++)
+                children.push_back(pool.push([]() {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }));
+            for (auto & c : children)
+                pool.get(c);
+        });
+        parent.get();
+    }
+
+    // one after another, so every post reuses the same event record
+    {
+        evt_runner<int> runner;
+        std::atomic<int> fired(0);
+        runner.register_event(1, [&fired](const int&) { ++fired; });
+        runner.start();
+        for (int i = 0; i < 10; i++) {
+            runner.send(1, i);
+            while (fired <= i)
+                std::this_thread::yield();
+        }
+        runner.stop();
+    }
+
+    {
+        task_runner runner(task_runner::stop_mode::WAIT_ALL_DONE);
+        runner.start();
+        for (int i = 0; i < 10; i++)
+            runner.send([]() {});
+        runner.push([]() {}, task_runner::now() + std::chrono::milliseconds(5));
+    }
+
+    tracer::enable(false);
+    std::ostringstream os;
+    tracer::dump(os);
+    std::string json = os.str();
+
+    assert(json_checker(json).check() && "trace dump is not valid json");
+    size_t steals = 0;
+    for (size_t at = 0; (at = json.find("\"name\":\"steal\",\"cat\":\"defer_pool\"", at)) != std::string::npos; at++)
+        steals++;
+    assert(steals > 0 && "defer_pool steals not traced");
+    auto events = started(json, "evt_runner");
+    assert(events.size() == 10);
+    for (auto & id : events)
+        assert(events.count(id) == 1 && "recycled evt_runner record traced under one id");
+    std::cout << "trace: " << json.size() << " bytes of valid json, " << steals << " defer_pool steals, "
+              << events.size() << " distinct evt_runner ids\n";
+
+    // load it in chrome://tracing or ui.perfetto.dev
+    if (argc > 1) {
+        std::ofstream out(argv[1]);
+        out << json;
+        std::cout << "written to " << argv[1] << "\n";
+    }
+    return 0;
+}
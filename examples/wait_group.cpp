@@ -0,0 +1,50 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#include "wait_group.h"
+#include "defer_pool.h"
+#include "task_group.h"
+#include <iostream>
+#include <cassert>
+
+int main() {
+    // batch of 10000 tasks, no futures
+    {
+        defer_pool pool(4);
+        std::atomic<int> n(0);
+        wait_group wg;
+        for (int i = 0; i < 10000; i++)
+            pool.execute(wg.wrap([&n](){ ++n; }));
+        wg.wait();
+        assert(n == 10000 && wg.pending() == 0);
+        std::cout << "batch done: " << n << "\n";
+
+        // a worker waiting for its own sub batch helps running it
+        auto f = pool.push([&pool]() {
+            std::atomic<int> m(0);
+            wait_group inner;
+            for (int i = 0; i < 100; i++)
+                pool.execute(inner.wrap([&m](){ ++m; }));
+            pool.wait(inner);
+            return m.load();
+        });
+        int m = f.get();
+        assert(m == 100);
+        std::cout << "nested batch done: " << m << "\n";
+    }
+
+    // task_group and task_runner have no futures at all
+    {
+        task_group tg(2);
+        tg.start();
+        wait_group wg;
+        for (int i = 0; i < 10; i++)
+            tg.send(wg.wrap([i](){ std::cout << "task " << i << "\n"; }));
+        auto status = wg.wait_for(std::chrono::seconds(1));
+        assert(status == std::future_status::ready);
+        std::cout << "task group batch done\n";
+    }
+
+    return 0;
+}
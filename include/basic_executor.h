@@ -0,0 +1,897 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_BASIC_EXECUTOR_H
+#define DISPATCHER_BASIC_EXECUTOR_H
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "event_count.h"
+#include "mpsc_queue.h"
+#include "sharded_counter.h"
+#include "trace.h"
+#ifdef __linux__
+#include <cerrno>
+#include <system_error>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+// executor assembled from compile time policies, no virtual dispatch on the hot path
+//
+// QueuePolicy  where runnable tasks wait: mutex_queue, mpmc_ring<N>, mpsc_intake (1 thread only),
+//              work_stealing
+// WaitPolicy   how idle threads wait: condvar_wait, spin_wait, futex_wait, timed_wait
+// TaskPolicy   what a task is: function_task (copyable callables), move_only_task
+// ClockPolicy  timer backend of execute_at/after: steady_timer, system_timer, timer_clock<C, D>,
+//              no_timer
+//
+// defer_runner and task_runner are built on it, they only add their own interface;
+// defer_pool is not, its helping wait(), deadline/CoDel shedding and compensation
+// workers hook into the worker loop itself, and toy/task_pool stays the standalone
+// testbed of the _wsq deque that work_stealing does not use
+
+// ---- queue policies, nested queue<Node> stores Node* and must be safe for any number
+// ---- of producers, pop() returns nullptr when (maybe transiently) nothing to take
+
+// hooks telling a queue which worker runs, only work_stealing cares
+struct worker_hooks {
+    // before any worker starts
+    void workers(size_t) {}
+    // on the worker thread, as it starts and stops
+    void bind_worker(size_t) {}
+    void unbind_worker() {}
+};
+
+struct mutex_queue {
+    static constexpr bool multi_consumer = true;
+    template<typename Node>
+    class queue : public worker_hooks {
+    public:
+        void push(Node* n) {
+            std::lock_guard<std::mutex> _(lock_);
+            q_.push(n);
+        }
+        Node* pop() {
+            std::lock_guard<std::mutex> _(lock_);
+            if (q_.empty())
+                return nullptr;
+            Node* n = q_.front();
+            q_.pop();
+            return n;
+        }
+        bool empty() {
+            std::lock_guard<std::mutex> _(lock_);
+            return q_.empty();
+        }
+    private:
+        std::queue<Node*> q_;
+        std::mutex lock_;
+    };
+};
+
+// bounded lock-free ring (Dmitry Vyukov's algorithm), push yields while full
+template<size_t Capacity>
+struct mpmc_ring {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2");
+    static constexpr bool multi_consumer = true;
+    template<typename Node>
+    class queue : public worker_hooks {
+        struct cell {
+            std::atomic<size_t> seq;
+            Node* node;
+        };
+    public:
+        queue() : cells_(new cell[Capacity]), enqueue_pos_(0), dequeue_pos_(0) {
+            for (size_t i = 0; i < Capacity; i++)
+                cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        void push(Node* n) {
+            while (!try_push(n))
+                std::this_thread::yield();
+        }
+        Node* pop() {
+            size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+            while (true) {
+                cell& c = cells_[pos & (Capacity - 1)];
+                size_t seq = c.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+                if (diff == 0) {
+                    if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        Node* n = c.node;
+                        c.seq.store(pos + Capacity, std::memory_order_release);
+                        return n;
+                    }
+                } else if (diff < 0) {
+                    return nullptr;
+                } else {
+                    pos = dequeue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        bool empty() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return dequeue_pos_.load(std::memory_order_relaxed) == enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    private:
+        bool try_push(Node* n) {
+            size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+            while (true) {
+                cell& c = cells_[pos & (Capacity - 1)];
+                size_t seq = c.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0) {
+                    if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        c.node = n;
+                        c.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        std::unique_ptr<cell[]> cells_;
+        std::atomic<size_t> enqueue_pos_;
+        char pad_[64 - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> dequeue_pos_;
+    };
+};
+
+// wait-free intake of task_runner/defer_runner, single consumer so single thread executors only
+struct mpsc_intake {
+    static constexpr bool multi_consumer = false;
+    template<typename Node>
+    class queue : public worker_hooks {
+    public:
+        void push(Node* n) { q_.push(n); }
+        Node* pop() { return q_.pop(); }
+        bool empty() { return q_.empty(); }
+    private:
+        mpsc_queue<Node> q_;
+    };
+};
+
+// a deque per worker: tasks pushed by a worker stay on its own deque (newest first for
+// the owner), others go to a shared injection queue, idle workers steal a sibling's oldest
+struct work_stealing {
+    static constexpr bool multi_consumer = true;
+    template<typename Node>
+    class queue {
+        struct local {
+            std::mutex lock;
+            std::deque<Node*> tasks;
+            char pad[64];  // keeps the locks of neighbours off one line
+        };
+        struct worker_ctx {
+            const queue* q;
+            size_t index;
+        };
+        static worker_ctx& current() {
+            static thread_local worker_ctx ctx{nullptr, 0};
+            return ctx;
+        }
+    public:
+        void workers(size_t n) {
+            while (locals_.size() < n)
+                locals_.emplace_back(new local);
+        }
+        void bind_worker(size_t i) { current() = worker_ctx{this, i}; }
+        void unbind_worker() { current() = worker_ctx{nullptr, 0}; }
+
+        void push(Node* n) {
+            const worker_ctx& ctx = current();
+            if (ctx.q != this) {
+                injection_.push(n);
+                return;
+            }
+            local& own = *locals_[ctx.index];
+            std::lock_guard<std::mutex> _(own.lock);
+            own.tasks.push_back(n);
+        }
+        Node* pop() {
+            const worker_ctx& ctx = current();
+            size_t me = ctx.q == this ? ctx.index : locals_.size();
+            if (me < locals_.size()) {
+                local& own = *locals_[me];
+                std::lock_guard<std::mutex> _(own.lock);
+                if (!own.tasks.empty()) {
+                    Node* n = own.tasks.back();
+                    own.tasks.pop_back();
+                    return n;
+                }
+            }
+            if (Node* n = injection_.pop())
+                return n;
+            for (size_t j = 1; j <= locals_.size(); j++) {
+                size_t v = (me + j) % locals_.size();
+                if (v == me)
+                    continue;
+                local& victim = *locals_[v];
+                std::lock_guard<std::mutex> _(victim.lock);
+                if (!victim.tasks.empty()) {
+                    Node* n = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    DISPATCHER_TRACE_EVENT(STEAL, "work_stealing", this, n);
+                    return n;
+                }
+            }
+            return nullptr;
+        }
+        bool empty() {
+            if (!injection_.empty())
+                return false;
+            for (auto & l : locals_) {
+                std::lock_guard<std::mutex> _(l->lock);
+                if (!l->tasks.empty())
+                    return false;
+            }
+            return true;
+        }
+    private:
+        std::vector<std::unique_ptr<local>> locals_;
+        mutex_queue::queue<Node> injection_;
+    };
+};
+
+// ---- wait policies, wait_until returns once pred() holds, deadline passes or notified,
+// ---- notify_one/all return false if nobody waited
+
+struct condvar_wait {
+    condvar_wait() : n_waiting_(0) {}
+    template<typename Pred, typename TimePoint>
+    void wait_until(Pred pred, const TimePoint& deadline) {
+        std::unique_lock<std::mutex> locker_(lock_);
+        ++n_waiting_;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (deadline == TimePoint::max())
+            condition_.wait(locker_, pred);
+        else
+            condition_.wait_until(locker_, deadline, pred);
+        --n_waiting_;
+    }
+    // lock only while somebody waits
+    bool notify_one() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n_waiting_.load(std::memory_order_relaxed) == 0)
+            return false;
+        std::lock_guard<std::mutex> _(lock_);
+        condition_.notify_one();
+        return true;
+    }
+    bool notify_all() {
+        std::lock_guard<std::mutex> _(lock_);
+        condition_.notify_all();
+        return n_waiting_.load(std::memory_order_relaxed) != 0;
+    }
+private:
+    std::mutex lock_;
+    std::condition_variable condition_;
+    std::atomic<int> n_waiting_;
+};
+
+// never sleeps, lowest latency for dedicated cores
+struct spin_wait {
+    template<typename Pred, typename TimePoint>
+    void wait_until(Pred pred, const TimePoint& deadline) {
+        for (size_t i = 0; !pred(); i++) {
+            if (i < 64) {
+                cpu_relax();
+                continue;
+            }
+            if (TimePoint::clock::now() >= deadline)
+                return;
+            std::this_thread::yield();
+        }
+    }
+    bool notify_one() { return false; }
+    bool notify_all() { return false; }
+};
+
+// event_count, notify is a fence and a load while nobody waits
+struct futex_wait {
+    template<typename Pred, typename TimePoint>
+    void wait_until(Pred pred, const TimePoint& deadline) {
+        auto key = ec_.prepare_wait();
+        if (pred()) {
+            ec_.cancel_wait();
+            return;
+        }
+        if (deadline == TimePoint::max())
+            ec_.wait(key);
+        else
+            ec_.wait_until(key, deadline);
+    }
+    bool notify_one() { return ec_.notify_one(); }
+    bool notify_all() { return ec_.notify_all(); }
+private:
+    event_count ec_;
+};
+
+// condvar, or timerfd with eventfd wakeups (precise, linux), picked at runtime;
+// the last spin before a deadline is busy-waited, counts the times it really blocked
+class timed_wait {
+public:
+    timed_wait() : precise_(false), spin_(0), timer_fd_(-1), wake_fd_(-1), n_waiting_(0), n_wakeups_(0) {}
+    // non-copyable
+    timed_wait(const timed_wait &) = delete;
+    timed_wait& operator=(const timed_wait &) = delete;
+    ~timed_wait() {
+#ifdef __linux__
+        if (timer_fd_ >= 0)
+            close(timer_fd_);
+        if (wake_fd_ >= 0)
+            close(wake_fd_);
+#endif
+    }
+
+    // before the first wait, throws std::system_error if timerfd/eventfd are not available
+    void configure(bool precise, std::chrono::nanoseconds spin) {
+        spin_ = spin;
+#ifdef __linux__
+        if (!precise || precise_)
+            return;
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (timer_fd_ < 0 || wake_fd_ < 0) {
+            int err = errno;
+            if (timer_fd_ >= 0)
+                close(timer_fd_);
+            if (wake_fd_ >= 0)
+                close(wake_fd_);
+            timer_fd_ = wake_fd_ = -1;
+            throw std::system_error(err, std::generic_category(), "timerfd/eventfd");
+        }
+        precise_ = true;
+#else
+        (void)precise;
+#endif
+    }
+    size_t wakeups() const { return n_wakeups_; }
+
+    template<typename Pred, typename TimePoint>
+    void wait_until(Pred pred, const TimePoint& deadline) {
+        using clock = typename TimePoint::clock;
+        // close enough, spin the rest
+        if (deadline != TimePoint::max() && deadline - clock::now() <= spin_) {
+            while (!pred() && clock::now() < deadline)
+                cpu_relax();
+            return;
+        }
+#ifdef __linux__
+        if (precise_)
+            return wait_precise(pred, deadline);
+#endif
+        std::unique_lock<std::mutex> locker_(lock_);
+        ++n_waiting_;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!pred()) {
+            if (deadline == TimePoint::max())
+                condition_.wait(locker_, pred);
+            else
+                condition_.wait_until(locker_, deadline - spin_, pred);
+            ++n_wakeups_;
+        }
+        --n_waiting_;
+    }
+    bool notify_one() { return notify(false); }
+    bool notify_all() { return notify(true); }
+
+private:
+#ifdef __linux__
+    // the timer is armed relative to now, so any clock works
+    template<typename Pred, typename TimePoint>
+    void wait_precise(Pred& pred, const TimePoint& deadline) {
+        ++n_waiting_;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (pred()) {
+            --n_waiting_;
+            return;
+        }
+        itimerspec spec{};
+        if (deadline != TimePoint::max()) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    deadline - spin_ - TimePoint::clock::now()).count();
+            if (left <= 0)
+                left = 1;
+            spec.it_value.tv_sec = static_cast<time_t>(left / 1000000000);
+            spec.it_value.tv_nsec = static_cast<long>(left % 1000000000);
+        }
+        // all zero disarms
+        timerfd_settime(timer_fd_, 0, &spec, nullptr);
+        pollfd fds[2] = {{timer_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+        while (::poll(fds, 2, -1) < 0 && errno == EINTR) {}
+        ++n_wakeups_;
+        uint64_t count;
+        ssize_t _ = read(wake_fd_, &count, sizeof(count));
+        _ = read(timer_fd_, &count, sizeof(count));
+        (void)_;
+        --n_waiting_;
+    }
+#endif
+    bool notify(bool all) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n_waiting_.load(std::memory_order_relaxed) == 0)
+            return false;
+#ifdef __linux__
+        if (precise_) {
+            uint64_t one = 1;
+            ssize_t _ = write(wake_fd_, &one, sizeof(one));
+            (void)_;  // counter saturated means a wakeup is pending anyway
+            return true;
+        }
+#endif
+        std::lock_guard<std::mutex> _(lock_);
+        if (all)
+            condition_.notify_all();
+        else
+            condition_.notify_one();
+        return true;
+    }
+
+private:
+    bool precise_;
+    std::chrono::nanoseconds spin_;
+    int timer_fd_;
+    int wake_fd_;
+    std::mutex lock_;
+    std::condition_variable condition_;
+    std::atomic<int> n_waiting_;
+    std::atomic<size_t> n_wakeups_;
+};
+
+// ---- task policies, type is a nullary callable built by make()
+
+struct function_task {
+    using type = std::function<void()>;
+    template<typename F>
+    static type make(F&& f) { return type(std::forward<F>(f)); }
+};
+
+// accepts move-only callables (e.g. lambdas capturing a packaged_task or unique_ptr)
+struct move_only_task {
+    class type {
+        struct base {
+            virtual ~base() = default;
+            virtual void call() = 0;
+        };
+        template<typename F>
+        struct impl : base {
+            explicit impl(F&& f) : f_(std::move(f)) {}
+            void call() override { f_(); }
+            F f_;
+        };
+    public:
+        template<typename F>
+        explicit type(F&& f) : p_(new impl<typename std::decay<F>::type>(std::forward<F>(f))) {}
+        void operator()() { p_->call(); }
+    private:
+        std::unique_ptr<base> p_;
+    };
+    template<typename F>
+    static type make(F&& f) { return type(std::forward<F>(f)); }
+};
+
+// ---- clock policies, nested timers<Node> is only touched under the executor's timer lock
+
+// a timed task may run up to its slack late, the executor wakes at the earliest
+// deadline (time + slack) and takes every task already due in one go
+template<typename Clock, typename Duration = typename Clock::duration>
+struct timer_clock {
+    static constexpr bool enabled = true;
+    using clock = Clock;
+    using duration = Duration;
+    using time_point = std::chrono::time_point<Clock, Duration>;
+    static time_point now() { return std::chrono::time_point_cast<Duration>(Clock::now()); }
+    template<typename Node>
+    class timers {
+    public:
+        void add(time_point tp, duration slack, Node* n) {
+            timers_.insert(std::make_pair(tp, std::make_pair(slack, n)));
+            deadlines_.insert(tp + slack);
+        }
+        time_point next() const { return deadlines_.empty() ? time_point::max() : *deadlines_.begin(); }
+        // move due ones (all if deadline is max) into out
+        void take(time_point deadline, std::vector<Node*>& out) {
+            auto it = timers_.begin();
+            for (; it != timers_.end() && it->first <= deadline; ++it) {
+                deadlines_.erase(deadlines_.find(it->first + it->second.first));
+                out.push_back(it->second.second);
+            }
+            timers_.erase(timers_.begin(), it);
+        }
+        bool empty() const { return timers_.empty(); }
+    private:
+        std::multimap<time_point, std::pair<duration, Node*>> timers_;
+        std::multiset<time_point> deadlines_;
+    };
+};
+using steady_timer = timer_clock<std::chrono::steady_clock>;
+using system_timer = timer_clock<std::chrono::system_clock>;
+
+// immediate tasks only, execute_at/after do not compile
+struct no_timer {
+    static constexpr bool enabled = false;
+    using clock = std::chrono::steady_clock;
+    using duration = clock::duration;
+    using time_point = clock::time_point;
+    static time_point now() { return clock::now(); }
+    template<typename Node>
+    struct timers {
+        void add(time_point, duration, Node*) {}
+        time_point next() const { return time_point::max(); }
+        void take(time_point, std::vector<Node*>&) {}
+        bool empty() const { return true; }
+    };
+};
+
+template<typename QueuePolicy,
+         typename WaitPolicy = condvar_wait,
+         typename TaskPolicy = function_task,
+         typename ClockPolicy = steady_timer>
+class basic_executor {
+public:
+    using task_t = typename TaskPolicy::type;
+    using clock = typename ClockPolicy::clock;
+    using duration = typename ClockPolicy::duration;
+    using time_point = typename ClockPolicy::time_point;
+    // gets exceptions escaping tasks
+    using exception_handler_t = std::function<void(std::exception_ptr)>;
+    enum class stop_mode {
+        DISCARD,  // finish running tasks, drop every other one
+        KEEP,     // finish running tasks, the rest stays for the next start()
+        FLUSH,    // also run the queued tasks, timed ones stay for the next start()
+        DRAIN     // also run queued and timed tasks (timed ones right away)
+    };
+
+protected:
+    using flag_t = std::atomic<bool>;
+    struct task_node : mpsc_node {
+        template<typename F>
+        explicit task_node(F&& f) : task(TaskPolicy::make(std::forward<F>(f))) {}
+        task_t task;
+    };
+
+public:
+    // starts n_threads workers right away
+    explicit basic_executor(size_t n_threads = 1) : basic_executor(n_threads, "basic_executor") { start(); }
+    // non-copyable
+    basic_executor(const basic_executor &) = delete;
+    basic_executor& operator=(const basic_executor &) = delete;
+    // non-movable
+    basic_executor(basic_executor &&) = delete;
+    basic_executor& operator=(basic_executor &&) = delete;
+    ~basic_executor() {
+        stop(stop_mode::DRAIN);
+        drop_all();
+    }
+
+    // no-op while running
+    void start();
+    void stop(stop_mode mode = stop_mode::DRAIN);
+
+    template<typename F, typename ...Args>
+    void execute(F&& f, Args&& ...args) {
+        execute(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    }
+    template<typename F>
+    void execute(F&& f) { enqueue(make_node(std::forward<F>(f))); }
+    template<typename F>
+    void execute_at(time_point tp, F&& f) { execute_at(tp, duration::zero(), std::forward<F>(f)); }
+    // may run up to slack after tp, so timers close together share a wakeup
+    template<typename F>
+    void execute_at(time_point tp, duration slack, F&& f);
+    template<typename F, typename Rep, typename Period>
+    void execute_after(std::chrono::duration<Rep, Period> d, F&& f) {
+        execute_at(now() + std::chrono::duration_cast<duration>(d), std::forward<F>(f));
+    }
+
+    template<typename F, typename ...Args>
+    auto submit(F&& f, Args&& ...args) -> std::future<decltype(f(args...))>;
+
+    // take a queued task out to run it elsewhere, empty if none
+    task_t pop();
+    // drop every task not started yet
+    void clear();
+
+    // without a handler an exception escaping a task terminates
+    void set_exception_handler(exception_handler_t handler);
+
+    inline size_t size() const { return threads_.size(); }
+    // queued and timed tasks not started yet
+    inline size_t pending() const { return n_pending_; }
+
+    static time_point now() { return ClockPolicy::now(); }
+
+protected:
+    // for executors built on this one: kind names them in traces, workers start with start()
+    basic_executor(size_t n_threads, const char* kind)
+            : n_threads_(n_threads), kind_(kind), next_timer_(time_point::max()), stop_(false),
+              stop_mode_(stop_mode::DRAIN) {
+        assert((QueuePolicy::multi_consumer || n_threads == 1) && "single consumer queue needs exactly one thread");
+        tasks_.workers(n_threads);
+    }
+
+    // counted in pending() until it runs or is dropped
+    template<typename F>
+    task_node* make_node(F&& f) {
+        ++n_pending_;
+        return new task_node(std::forward<F>(f));
+    }
+    void enqueue(task_node* tp);
+    // extra task source, polled once the queue is empty (e.g. a work sharing deque), set
+    // before start(): take(draining) gives a task or nullptr, ready() says one may be there
+    void set_source(std::function<task_node*(bool)> take, std::function<bool()> ready) {
+        source_ = std::move(take);
+        source_ready_ = std::move(ready);
+    }
+    // wake an idle worker (to look at the source), false if none was asleep
+    bool notify() { return idle_.notify_one(); }
+    bool on_worker() const { return current() == this; }
+    bool running() const { return !threads_.empty(); }
+    WaitPolicy& waiter() { return idle_; }
+    const WaitPolicy& waiter() const { return idle_; }
+
+private:
+    static const basic_executor*& current() {
+        static thread_local const basic_executor* ex = nullptr;
+        return ex;
+    }
+    void loop(size_t index);
+    // single consumer queues are consumed under consumer_lock_, so pop() may run anywhere
+    task_node* take();
+    bool queue_empty();
+    // move due timed tasks into the queue, returns the next deadline
+    time_point fire_timers(bool all);
+    void run(task_node* tp);
+    void drop_all();
+    void on_exception(std::exception_ptr e);
+
+protected:
+    sharded_counter n_pending_;
+
+private:
+    size_t const n_threads_;
+    const char* const kind_;
+    std::vector<std::thread> threads_;
+    typename QueuePolicy::template queue<task_node> tasks_;
+    std::mutex consumer_lock_;
+    WaitPolicy idle_;
+    std::mutex timer_lock_;
+    typename ClockPolicy::template timers<task_node> timers_;
+    std::atomic<time_point> next_timer_;  // earliest deadline, lets idle threads skip timer_lock_
+    flag_t stop_;
+    stop_mode stop_mode_;  // written before stop_ is set
+    std::function<task_node*(bool)> source_;
+    std::function<bool()> source_ready_;
+    std::mutex handler_lock_;
+    exception_handler_t handler_;
+};
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::start() {
+    if (!threads_.empty())
+        return;
+    stop_ = false;
+    for (size_t i = 0; i < n_threads_; i++)
+        threads_.emplace_back(&basic_executor::loop, this, i);
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::stop(stop_mode mode) {
+    if (threads_.empty()) {
+        if (mode == stop_mode::DISCARD)
+            drop_all();
+        return;
+    }
+    stop_mode_ = mode;
+    stop_ = true;
+    idle_.notify_all();
+    for (auto & thread : threads_)
+        thread.join();
+    threads_.clear();
+    if (mode == stop_mode::DISCARD)
+        drop_all();
+}
+
+template<typename Q, typename W, typename T, typename C>
+template<typename F>
+inline void basic_executor<Q, W, T, C>::execute_at(time_point tp, duration slack, F&& f) {
+    static_assert(C::enabled, "no_timer executor can not schedule timed tasks");
+    auto node = make_node(std::forward<F>(f));
+    DISPATCHER_TRACE_EVENT(ENQUEUE, kind_, this, node);
+    {
+        std::lock_guard<std::mutex> _(timer_lock_);
+        timers_.add(tp, slack, node);
+        next_timer_ = timers_.next();
+    }
+    // a sleeper may wait for a later deadline
+    idle_.notify_one();
+}
+
+template<typename Q, typename W, typename T, typename C>
+template<typename F, typename ...Args>
+inline auto basic_executor<Q, W, T, C>::submit(F&& f, Args&& ...args)
+    -> std::future<decltype(f(args...))> {
+    auto pck = std::make_shared<std::packaged_task<decltype(f(args...))()>>(
+            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    auto future = pck->get_future();
+    execute([pck](){ (*pck)(); });
+    return future;
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline typename basic_executor<Q, W, T, C>::task_t basic_executor<Q, W, T, C>::pop() {
+    std::unique_ptr<task_node> tp(take());
+    if (!tp)
+        return task_t();
+    --n_pending_;
+    DISPATCHER_TRACE_EVENT(DEQUEUE, kind_, this, tp.get());
+    return std::move(tp->task);
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::clear() {
+    drop_all();
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::set_exception_handler(exception_handler_t handler) {
+    std::lock_guard<std::mutex> _(handler_lock_);
+    handler_ = std::move(handler);
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::on_exception(std::exception_ptr e) {
+    exception_handler_t handler;
+    {
+        std::lock_guard<std::mutex> _(handler_lock_);
+        handler = handler_;
+    }
+    if (!handler)
+        std::rethrow_exception(e);
+    handler(e);
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::enqueue(task_node* tp) {
+    DISPATCHER_TRACE_EVENT(ENQUEUE, kind_, this, tp);
+    tasks_.push(tp);
+    idle_.notify_one();
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline typename basic_executor<Q, W, T, C>::task_node* basic_executor<Q, W, T, C>::take() {
+    std::unique_lock<std::mutex> locker_(consumer_lock_, std::defer_lock);
+    if (!Q::multi_consumer)
+        locker_.lock();
+    task_node* tp = tasks_.pop();
+    // a producer may still be linking its node
+    while (!tp && !tasks_.empty())
+        tp = tasks_.pop();
+    return tp;
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline bool basic_executor<Q, W, T, C>::queue_empty() {
+    std::unique_lock<std::mutex> locker_(consumer_lock_, std::defer_lock);
+    if (!Q::multi_consumer)
+        locker_.lock();
+    return tasks_.empty();
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline typename basic_executor<Q, W, T, C>::time_point basic_executor<Q, W, T, C>::fire_timers(bool all) {
+    if (!C::enabled)
+        return time_point::max();
+    if (!all && next_timer_.load() > now())
+        return next_timer_;
+    std::vector<task_node*> due;
+    time_point next;
+    {
+        std::lock_guard<std::mutex> _(timer_lock_);
+        timers_.take(all ? time_point::max() : now(), due);
+        next = timers_.next();
+        next_timer_ = next;
+    }
+    for (auto tp : due)
+        tasks_.push(tp);
+    if (due.size() > 1)
+        idle_.notify_all();
+    return next;
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::run(task_node* tp) {
+    DISPATCHER_TRACE_EVENT(DEQUEUE, kind_, this, tp);
+    std::unique_ptr<task_node> utp(tp);
+    --n_pending_;
+    DISPATCHER_TRACE_EVENT(START, kind_, this, tp);
+    try {
+        tp->task();
+    } catch (...) {
+        on_exception(std::current_exception());
+    }
+    DISPATCHER_TRACE_EVENT(FINISH, kind_, this, tp);
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::loop(size_t index) {
+    current() = this;
+    tasks_.bind_worker(index);
+    while (!stop_) {
+        time_point next = fire_timers(false);
+        task_node* tp = take();
+        if (!tp && source_)
+            tp = source_(false);
+        if (tp) {
+            run(tp);
+            continue;
+        }
+        idle_.wait_until([this, next]() {
+            // a timer added meanwhile may be due before the deadline slept towards
+            time_point t = next_timer_.load();
+            return stop_ || !queue_empty() || t < next || t <= now() || (source_ready_ && source_ready_());
+        }, next);
+    }
+    current() = nullptr;
+    if (stop_mode_ == stop_mode::DRAIN)
+        fire_timers(true);
+    if (stop_mode_ == stop_mode::FLUSH || stop_mode_ == stop_mode::DRAIN) {
+        // tasks run now may queue more, run those too
+        while (task_node* tp = take())
+            run(tp);
+        while (stop_mode_ == stop_mode::DRAIN && source_) {
+            task_node* tp = source_(true);
+            if (!tp)
+                break;
+            run(tp);
+            while (task_node* next = take())
+                run(next);
+        }
+    }
+    tasks_.unbind_worker();
+}
+
+template<typename Q, typename W, typename T, typename C>
+inline void basic_executor<Q, W, T, C>::drop_all() {
+    std::vector<task_node*> left;
+    {
+        std::lock_guard<std::mutex> _(timer_lock_);
+        timers_.take(time_point::max(), left);
+        next_timer_ = time_point::max();
+    }
+    while (task_node* tp = take())
+        left.push_back(tp);
+    n_pending_ -= left.size();
+    for (auto tp : left)
+        delete tp;
+}
+
+// stand-alone configurations, see defer_runner and task_runner for the ones they build on
+using serial_executor = basic_executor<mpsc_intake, condvar_wait>;
+using pool_executor = basic_executor<mutex_queue, condvar_wait>;
+using stealing_pool_executor = basic_executor<work_stealing, futex_wait>;
+using spin_pool_executor = basic_executor<mpmc_ring<1024>, spin_wait, function_task, no_timer>;
+
+#endif //DISPATCHER_BASIC_EXECUTOR_H
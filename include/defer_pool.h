@@ -6,22 +6,170 @@
 #define DISPATCHER_DEFER_POOL_H
 
 #include "safe_queue.h"
+#include "trace.h"
 #include <thread>
 #include <vector>
 #include <atomic>
 #include <functional>
 #include <memory>
 #include <future>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <exception>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <typeinfo>
+#include <new>
+#include <cstdint>
+
+// future error of a task whose deadline passed before a worker got to it
+class task_expired : public std::runtime_error {
+public:
+    task_expired() : std::runtime_error("task expired before execution") {}
+};
+
+// future error of a task dropped by adaptive load shedding
+class task_shed : public std::runtime_error {
+public:
+    task_shed() : std::runtime_error("task shed under overload") {}
+};
 
 class defer_pool {
 public:
     using task_t = std::function<void()>;
+    using clock = std::chrono::steady_clock;
+    // gets exceptions escaping execute() tasks
+    using exception_handler_t = std::function<void(std::exception_ptr)>;
 private:
     using flag_t = std::atomic<bool>;
     using locker = std::unique_lock<std::mutex>;
+    using drop_t = std::function<void(std::exception_ptr)>;
+    struct task_node {
+        template<typename F>
+        explicit task_node(F&& f) : task(std::forward<F>(f)), deadline(clock::time_point::max()) {}
+        task_t task;
+        drop_t drop;  // completes the future instead of task, empty if task can not be dropped
+        clock::time_point deadline;
+        clock::time_point enqueued;  // stamped only while codel is on
+    };
+    // tasks pushed from a worker, owner pops newest first, others steal oldest first
+    struct local_t {
+        std::mutex lock;
+        std::deque<task_node*> tasks;
+        bool owned = true;  // false once its worker exited, reused by the next one
+    };
+    using locals_t = std::vector<std::shared_ptr<local_t>>;
+    // pool and local queue of the current thread if it is a worker
+    struct worker_t {
+        defer_pool* pool;
+        local_t* local;
+        size_t blocking;  // nesting depth of blocking_scope
+    };
+    // detaches a worker from its local queue on exit, leftovers go to the global queue
+    struct exit_guard {
+        defer_pool* pool;
+        local_t* local;
+        ~exit_guard() {
+            current() = worker_t{nullptr, nullptr, 0};
+            std::deque<task_node*> leftovers;
+            {
+                std::lock_guard<std::mutex> _(local->lock);
+                local->owned = false;
+                leftovers.swap(local->tasks);
+            }
+            if (leftovers.empty())
+                return;
+            for (auto tp : leftovers)
+                pool->tasks_.push(tp);
+            locker _(pool->lock_);
+            pool->condition_.notify_all();
+        }
+    };
+    // CoDel (controlled delay) state, drops while queue sojourn stays above target
+    struct codel_t {
+        clock::duration target;
+        clock::duration interval;
+        clock::time_point first_above;  // epoch if sojourn is below target
+        clock::time_point drop_next;
+        size_t drop_count;
+        bool dropping;
+    };
+    // push_once tasks queued or running, sharded by key hash so callers of
+    // unrelated keys do not serialize on one lock
+    static constexpr size_t FLIGHT_SHARDS = 16;
+    struct flight_t {
+        std::shared_ptr<void> future;  // std::shared_future<R>
+        const std::type_info* type;    // R, every caller of a key must agree on it
+    };
+    struct alignas(64) flight_shard {
+        std::mutex lock;
+        std::unordered_map<std::string, flight_t> keys;
+    };
+    // the shards placed by hand in one heap block: new ignores alignas beyond max_align_t
+    // before C++17, and a by-value array would make defer_pool itself over-aligned
+    struct flight_table {
+        flight_table() : raw(new char[FLIGHT_SHARDS * sizeof(flight_shard) + alignof(flight_shard) - 1]) {
+            auto addr = reinterpret_cast<uintptr_t>(raw.get());
+            shards = reinterpret_cast<flight_shard*>(
+                    (addr + alignof(flight_shard) - 1) & ~static_cast<uintptr_t>(alignof(flight_shard) - 1));
+            for (size_t i = 0; i < FLIGHT_SHARDS; i++)
+                new (&shards[i]) flight_shard();
+        }
+        ~flight_table() {
+            for (size_t i = 0; i < FLIGHT_SHARDS; i++)
+                shards[i].~flight_shard();
+        }
+        flight_shard& operator[](size_t i) { return shards[i]; }
+        std::unique_ptr<char[]> raw;
+        flight_shard* shards;
+    };
+    // owned by the task, drops the key once the task is gone (run, or cleared unrun)
+    struct flight_guard {
+        flight_guard(flight_shard& s, std::string k, const void* f) : shard(s), key(std::move(k)), future(f) {}
+        ~flight_guard() {
+            std::lock_guard<std::mutex> _(shard.lock);
+            auto it = shard.keys.find(key);
+            if (it != shard.keys.end() && it->second.future.get() == future)
+                shard.keys.erase(it);
+        }
+        flight_shard& shard;
+        std::string key;
+        const void* future;
+    };
 
 public:
-    defer_pool() : tasks_done_(false), pool_stop_(false), n_idle(0) { };
+    // hint around a call that may block (disk, locks) from a task of this pool,
+    // the pool runs a spare worker meanwhile so queued tasks keep their parallelism
+    //
+    //     {
+    //         defer_pool::blocking_scope _;
+    //         read(fd, buf, n);
+    //     }
+    //
+    // no-op off the pool's workers, nested scopes count once
+    class blocking_scope {
+    public:
+        blocking_scope() : pool_(current().pool) {
+            if (pool_ && current().blocking++ == 0)
+                pool_->begin_blocking();
+        }
+        ~blocking_scope() {
+            if (pool_ && --current().blocking == 0)
+                pool_->end_blocking();
+        }
+        // non-copyable
+        blocking_scope(const blocking_scope &) = delete;
+        blocking_scope& operator=(const blocking_scope &) = delete;
+    private:
+        defer_pool* const pool_;
+    };
+
+    defer_pool() : locals_(std::make_shared<locals_t>()),
+                   tasks_done_(false), pool_stop_(false), n_idle(0), n_helpers_(0),
+                   codel_on_(false), n_expired_(0), n_shed_(0), n_deduplicated_(0),
+                   max_spares_(256), n_blocked_(0), n_active_spares_(0), n_parked_(0), n_unparks_(0) { };
     explicit defer_pool(size_t n_threads);
     // non-copyable
     defer_pool(const defer_pool &) = delete;
@@ -36,6 +184,13 @@ public:
 
     inline size_t size() const { return threads_.size(); }
     inline size_t idle_threads() const { return n_idle; }
+    // spare workers standing in for blocked ones right now
+    inline size_t spare_threads() const { return n_active_spares_; }
+    // hard cap on spare workers running at once, 256 unless set
+    void set_max_spare_threads(size_t n) {
+        locker _(spares_lock_);
+        max_spares_ = n;
+    }
 
     void resize(size_t n_threads);
 
@@ -43,20 +198,106 @@ public:
     auto push(F&& f, Args&& ...args) -> std::future<decltype(f(args...))>;
     template<typename F>
     auto push(F&& f) -> std::future<decltype(f())>;
+    // task is dropped without running if still queued at deadline,
+    // its future then throws task_expired (or task_shed, see enable_codel)
+    template<typename F, typename ...Args>
+    auto push_with_deadline(clock::time_point deadline, F&& f, Args&& ...args)
+        -> std::future<decltype(f(args...))>;
+    // single-flight: runs f unless a task of the same key is still queued or running,
+    // then returns the future of that one instead, so all callers share one result;
+    // throws std::logic_error if that one has a different result type
+    template<typename F, typename ...Args>
+    auto push_once(const std::string& key, F&& f, Args&& ...args)
+        -> std::shared_future<decltype(f(args...))>;
+    template<typename F>
+    auto push_once(const std::string& key, F&& f) -> std::shared_future<decltype(f())>;
     task_t pop();
 
+    // fire and forget, no future or shared state, exceptions go to the exception handler
+    template<typename F, typename ...Args>
+    void execute(F&& f, Args&& ...args);
+    template<typename F>
+    void execute(F&& f);
+    // without a handler an exception escaping an execute() task terminates
+    void set_exception_handler(exception_handler_t handler);
+
+    // wait for a future, called from one of this pool's workers it runs other queued
+    // tasks meanwhile (own children first) instead of blocking; f need not come from
+    // this pool, with nothing to run the worker re-checks it every millisecond
+    template<typename Future>
+    void wait(const Future& f);
+    template<typename R>
+    R get(std::future<R>& f) { wait(f); return f.get(); }
+    template<typename R>
+    R get(const std::shared_future<R>& f) { wait(f); return f.get(); }
+
+    // shed deadline tasks while queue sojourn time stays above target for an interval
+    void enable_codel(clock::duration target = std::chrono::milliseconds(5),
+                      clock::duration interval = std::chrono::milliseconds(100));
+    void disable_codel() { codel_on_ = false; }
+
+    inline size_t expired_tasks() const { return n_expired_; }
+    inline size_t shed_tasks() const { return n_shed_; }
+    // push_once calls that joined a task in flight instead of pushing one
+    inline size_t deduplicated_tasks() const { return n_deduplicated_; }
+
 private:
     void setup_thread(size_t i);
+    // register a local queue for the calling worker, reusing one left by an exited worker
+    std::shared_ptr<local_t> attach_local();
+    void begin_blocking();
+    void end_blocking();
+    // more active spares than blocked workers
+    bool spare_surplus() const { return n_active_spares_ > n_blocked_; }
+    bool try_retire(local_t* local);
+    void spare_main();
+    // works like a regular worker until it is not needed anymore, false once the pool stops
+    bool run_spare(local_t* local);
+    void join_spares();
+    static worker_t& current() {
+        static thread_local worker_t worker{nullptr, nullptr, 0};
+        return worker;
+    }
+    // own local queue, then global queue, then other workers' local queues
+    task_node* next_task(local_t* own);
+    task_node* steal_task(local_t* own);
+    void run_task(task_node* tp);
+    void enqueue(task_node* tp);
+    // false if the task got dropped instead
+    bool admit(task_node* tp);
+    bool codel_drop(clock::time_point now, clock::duration sojourn, bool droppable);
+    void on_exception(std::exception_ptr e);
 
 private:
     std::vector<std::unique_ptr<std::thread>> threads_;
     std::vector<std::shared_ptr<flag_t>> threads_stop_flags_;
-    safe_queue<task_t*> tasks_;
+    safe_queue<task_node*> tasks_;
+    std::shared_ptr<locals_t> locals_;  // copy on write, see setup_thread
+    std::mutex locals_lock_;
     std::mutex lock_;
     std::condition_variable condition_;
     flag_t tasks_done_;
     flag_t pool_stop_;
     std::atomic<int> n_idle;
+    std::atomic<int> n_helpers_;  // workers blocked in wait()
+    flag_t codel_on_;
+    std::mutex codel_lock_;
+    codel_t codel_;
+    std::atomic<size_t> n_expired_;
+    std::atomic<size_t> n_shed_;
+    flight_table flights_;
+    std::atomic<size_t> n_deduplicated_;
+    // compensation for blocked workers, counts change under spares_lock_ only
+    std::mutex spares_lock_;
+    std::condition_variable spare_cv_;
+    std::vector<std::unique_ptr<std::thread>> spares_;
+    size_t max_spares_;
+    std::atomic<size_t> n_blocked_;        // workers inside a blocking_scope
+    std::atomic<size_t> n_active_spares_;
+    size_t n_parked_;                      // retired spares waiting to be reused
+    size_t n_unparks_;                     // activations handed to parked spares
+    std::mutex handler_lock_;
+    exception_handler_t handler_;
 };
 
 inline defer_pool::defer_pool(size_t n_threads) : defer_pool() {
@@ -92,15 +333,29 @@ inline void defer_pool::stop(bool wait) {
     for (auto & thread : threads_)
         if (thread->joinable())
             thread->join();
+    join_spares();
     clear_tasks();
     threads_.clear();
     threads_stop_flags_.clear();
 }
 
 inline void defer_pool::clear_tasks() {
-    task_t* tp = nullptr;
+    task_node* tp = nullptr;
     while (tasks_.pop(tp))
         delete tp;
+    auto locals = std::atomic_load(&locals_);
+    for (auto & local : *locals) {
+        std::lock_guard<std::mutex> _(local->lock);
+        for (auto t : local->tasks)
+            delete t;
+        local->tasks.clear();
+    }
+}
+
+inline void defer_pool::enable_codel(clock::duration target, clock::duration interval) {
+    locker _(codel_lock_);
+    codel_ = codel_t{target, interval, clock::time_point(), clock::time_point(), 0, false};
+    codel_on_ = true;
 }
 
 inline void defer_pool::resize(size_t n_threads) {
@@ -132,15 +387,34 @@ inline void defer_pool::resize(size_t n_threads) {
     }
 }
 
+inline void defer_pool::enqueue(task_node* tp) {
+    if (codel_on_)
+        tp->enqueued = clock::now();
+    DISPATCHER_TRACE_EVENT(ENQUEUE, "defer_pool", this, tp);
+    worker_t& worker = current();
+    if (worker.pool == this) {
+        // child task, stays close to its parent unless an idle worker steals it
+        {
+            std::lock_guard<std::mutex> _(worker.local->lock);
+            worker.local->tasks.push_back(tp);
+        }
+        if (n_idle > 0 || n_helpers_ > 0) {
+            locker _(lock_);
+            condition_.notify_one();
+        }
+        return;
+    }
+    tasks_.push(tp);
+    locker _(lock_);
+    condition_.notify_one();
+}
+
 template<typename F, typename ...Args>
 inline auto defer_pool::push(F&& f, Args&& ...args)
     -> std::future<decltype(f(args...))> {
     auto pck = std::make_shared<std::packaged_task<decltype(f(args...))()>>(
             std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-    auto tp = new task_t([pck](){ (*pck)(); });
-    tasks_.push(tp);
-    locker _(lock_);
-    condition_.notify_one();
+    enqueue(new task_node([pck](){ (*pck)(); }));
     return pck->get_future();
 }
 
@@ -148,52 +422,279 @@ template<typename F>
 inline auto defer_pool::push(F&& f)
     -> std::future<decltype(f())> {
     auto pck = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
-    auto tp = new task_t([pck](){ (*pck)(); });
-    tasks_.push(tp);
-    locker _(lock_);
-    condition_.notify_one();
+    enqueue(new task_node([pck](){ (*pck)(); }));
+    return pck->get_future();
+}
+
+template<typename F, typename ...Args>
+inline auto defer_pool::push_once(const std::string& key, F&& f, Args&& ...args)
+    -> std::shared_future<decltype(f(args...))> {
+    return push_once(key, std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+}
+
+template<typename F>
+inline auto defer_pool::push_once(const std::string& key, F&& f)
+    -> std::shared_future<decltype(f())> {
+    using result_t = decltype(f());
+    flight_shard& shard = flights_[std::hash<std::string>()(key) % FLIGHT_SHARDS];
+    std::shared_ptr<std::packaged_task<result_t()>> pck;
+    std::shared_ptr<std::shared_future<result_t>> future;
+    {
+        std::lock_guard<std::mutex> _(shard.lock);
+        auto it = shard.keys.find(key);
+        if (it != shard.keys.end()) {
+            if (*it->second.type != typeid(result_t))
+                throw std::logic_error("defer_pool::push_once: key " + key + " is in flight with another result type");
+            ++n_deduplicated_;
+            return *std::static_pointer_cast<std::shared_future<result_t>>(it->second.future);
+        }
+        pck = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(f));
+        future = std::make_shared<std::shared_future<result_t>>(pck->get_future().share());
+        shard.keys.emplace(key, flight_t{future, &typeid(result_t)});
+    }
+    auto guard = std::make_shared<flight_guard>(shard, key, future.get());
+    enqueue(new task_node([pck, guard](){ (*pck)(); }));
+    return *future;
+}
+
+template<typename F, typename ...Args>
+inline void defer_pool::execute(F&& f, Args&& ...args) {
+    enqueue(new task_node(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+}
+
+template<typename F>
+inline void defer_pool::execute(F&& f) {
+    enqueue(new task_node(std::forward<F>(f)));
+}
+
+inline void defer_pool::set_exception_handler(exception_handler_t handler) {
+    locker _(handler_lock_);
+    handler_ = std::move(handler);
+}
+
+// pushed tasks never throw (packaged_task keeps the exception), only executed ones
+inline void defer_pool::on_exception(std::exception_ptr e) {
+    exception_handler_t handler;
+    {
+        locker _(handler_lock_);
+        handler = handler_;
+    }
+    if (!handler)
+        std::rethrow_exception(e);
+    handler(e);
+}
+
+template<typename F, typename ...Args>
+inline auto defer_pool::push_with_deadline(clock::time_point deadline, F&& f, Args&& ...args)
+    -> std::future<decltype(f(args...))> {
+    using result_t = decltype(f(args...));
+    auto fn = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    // set only when dropped, then the packaged task throws it instead of running fn
+    auto error = std::make_shared<std::exception_ptr>();
+    auto pck = std::make_shared<std::packaged_task<result_t()>>([fn, error]() mutable -> result_t {
+        if (*error)
+            std::rethrow_exception(*error);
+        return fn();
+    });
+    auto tp = new task_node([pck](){ (*pck)(); });
+    tp->drop = [pck, error](std::exception_ptr e){
+        *error = e;
+        (*pck)();
+    };
+    tp->deadline = deadline;
+    enqueue(tp);
     return pck->get_future();
 }
 
 inline defer_pool::task_t defer_pool::pop() {
-    task_t* tp = nullptr;
-    tasks_.pop(tp);
+    task_node* tp = nullptr;
+    if (!tasks_.pop(tp))
+        tp = steal_task(nullptr);
     task_t task;
-    std::unique_ptr<task_t> utp(tp);
+    std::unique_ptr<task_node> utp(tp);
     if (tp)
-        task = *tp;
+        task = std::move(tp->task);
     return task;
 }
 
+inline defer_pool::task_node* defer_pool::next_task(local_t* own) {
+    task_node* tp = nullptr;
+    if (own) {
+        std::lock_guard<std::mutex> _(own->lock);
+        if (!own->tasks.empty()) {
+            tp = own->tasks.back();
+            own->tasks.pop_back();
+            return tp;
+        }
+    }
+    if (tasks_.pop(tp))
+        return tp;
+    return steal_task(own);
+}
+
+inline defer_pool::task_node* defer_pool::steal_task(local_t* own) {
+    auto locals = std::atomic_load(&locals_);
+    for (auto & local : *locals) {
+        if (local.get() == own)
+            continue;
+        std::lock_guard<std::mutex> _(local->lock);
+        if (!local->tasks.empty()) {
+            task_node* tp = local->tasks.front();
+            local->tasks.pop_front();
+            DISPATCHER_TRACE_EVENT(STEAL, "defer_pool", this, tp);
+            return tp;
+        }
+    }
+    return nullptr;
+}
+
+inline void defer_pool::run_task(task_node* tp) {
+    DISPATCHER_TRACE_EVENT(DEQUEUE, "defer_pool", this, tp);
+    // drop task function after execution
+    std::unique_ptr<task_node> utp(tp);
+    // execute task unless expired or shed
+    if (admit(tp)) {
+        DISPATCHER_TRACE_EVENT(START, "defer_pool", this, tp);
+        try {
+            tp->task();
+        } catch (...) {
+            on_exception(std::current_exception());
+        }
+        DISPATCHER_TRACE_EVENT(FINISH, "defer_pool", this, tp);
+    }
+    // a waiting helper may be waiting for exactly this one
+    if (n_helpers_ > 0) {
+        locker _(lock_);
+        condition_.notify_all();
+    }
+}
+
+template<typename Future>
+inline void defer_pool::wait(const Future& f) {
+    worker_t& worker = current();
+    if (worker.pool != this) {
+        f.wait();
+        return;
+    }
+    auto ready = [&f]() {
+        return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
+    while (!ready()) {
+        task_node* tp = next_task(worker.local);
+        if (!tp) {
+            locker locker_(lock_);
+            ++n_helpers_;
+            // woken by any push or any task finished here, f may also be completed
+            // elsewhere (a promise, another executor), so look again every millisecond
+            condition_.wait_for(locker_, std::chrono::milliseconds(1), [&]() {
+                return ready() || (tp = next_task(worker.local)) != nullptr;
+            });
+            --n_helpers_;
+        }
+        if (tp)
+            run_task(tp);
+    }
+}
+
+inline bool defer_pool::admit(task_node* tp) {
+    if (!tp->drop && !codel_on_)
+        return true;
+    auto now = clock::now();
+    if (tp->drop && now > tp->deadline) {
+        ++n_expired_;
+        tp->drop(std::make_exception_ptr(task_expired()));
+        return false;
+    }
+    if (codel_on_ && tp->enqueued != clock::time_point() &&
+        codel_drop(now, now - tp->enqueued, static_cast<bool>(tp->drop))) {
+        ++n_shed_;
+        tp->drop(std::make_exception_ptr(task_shed()));
+        return false;
+    }
+    return true;
+}
+
+// see RFC 8289, only droppable tasks consume a drop
+inline bool defer_pool::codel_drop(clock::time_point now, clock::duration sojourn, bool droppable) {
+    locker _(codel_lock_);
+    if (sojourn < codel_.target) {
+        // good queue again
+        codel_.first_above = clock::time_point();
+        codel_.dropping = false;
+        return false;
+    }
+    if (codel_.first_above == clock::time_point()) {
+        codel_.first_above = now + codel_.interval;
+        return false;
+    }
+    auto control_law = [this](clock::time_point t) {
+        return t + std::chrono::duration_cast<clock::duration>(
+                codel_.interval / std::sqrt(static_cast<double>(codel_.drop_count)));
+    };
+    if (!codel_.dropping) {
+        if (now < codel_.first_above || !droppable)
+            return false;
+        // above target for a whole interval, start dropping
+        codel_.dropping = true;
+        codel_.drop_count = (codel_.drop_count > 2 && now - codel_.drop_next < 8 * codel_.interval)
+                            ? codel_.drop_count - 2 : 1;
+        codel_.drop_next = control_law(now);
+        return true;
+    }
+    if (now < codel_.drop_next || !droppable)
+        return false;
+    // drop faster while still above target
+    ++codel_.drop_count;
+    codel_.drop_next = control_law(codel_.drop_next);
+    return true;
+}
+
+// kept registered after exit, so a detached worker does not
+// touch the pool unless it has leftovers to hand over
+inline std::shared_ptr<defer_pool::local_t> defer_pool::attach_local() {
+    std::lock_guard<std::mutex> _(locals_lock_);
+    for (auto & l : *locals_) {
+        std::lock_guard<std::mutex> local_lock(l->lock);
+        if (!l->owned) {
+            l->owned = true;
+            return l;
+        }
+    }
+    auto local = std::make_shared<local_t>();
+    auto locals = std::make_shared<locals_t>(*locals_);
+    locals->push_back(local);
+    std::atomic_store(&locals_, std::shared_ptr<locals_t>(std::move(locals)));
+    return local;
+}
+
 inline void defer_pool::setup_thread(size_t i)  {
     std::shared_ptr<flag_t> fp(threads_stop_flags_[i]);
     auto loop_f = [this, fp]() {
         flag_t& stop = *fp;
-        task_t* tp = nullptr;
-        bool has_next = tasks_.pop(tp);
+        std::shared_ptr<local_t> local = attach_local();
+        current() = worker_t{this, local.get(), 0};
+        exit_guard guard{this, local.get()};
+        task_node* tp = next_task(local.get());
         while (true) {
-            while (has_next) {
-                // drop task function after execution
-                std::unique_ptr<task_t> utp(tp);
-                // execute task
-                (*tp)();
+            while (tp) {
+                run_task(tp);
                 // if stop flag set, then stop loop
                 if (stop)
                     return;
                 // fetch next task
-                has_next = tasks_.pop(tp);
+                tp = next_task(local.get());
             }
             // no tasks now
             locker locker_(lock_);
             ++n_idle;
             // check whether new task coming or stop
-            condition_.wait(locker_, [this, &tp, &has_next, &stop](){
-                has_next = tasks_.pop(tp);
-                return stop || tasks_done_ || has_next;
+            condition_.wait(locker_, [this, &tp, &stop, &local](){
+                tp = next_task(local.get());
+                return stop || tasks_done_ || tp;
             });
             --n_idle;
             // no new task coming, then stop
-            if (!has_next)
+            if (!tp)
                 return;
         }
     };
@@ -201,4 +702,108 @@ inline void defer_pool::setup_thread(size_t i)  {
     threads_[i].reset(new std::thread(loop_f));
 }
 
+// activates a spare unless enough of them already run, parked spares are reused first
+inline void defer_pool::begin_blocking() {
+    locker _(spares_lock_);
+    ++n_blocked_;
+    if (pool_stop_ || tasks_done_ || n_active_spares_ >= n_blocked_ || n_active_spares_ >= max_spares_)
+        return;
+    ++n_active_spares_;
+    if (n_parked_ > n_unparks_) {
+        ++n_unparks_;
+        spare_cv_.notify_one();
+        return;
+    }
+    // no spare if the thread can not be started, the blocked worker just is not covered
+    try {
+        spares_.emplace_back();
+        spares_.back().reset(new std::thread(&defer_pool::spare_main, this));
+    } catch (...) {
+        if (!spares_.empty() && !spares_.back())
+            spares_.pop_back();
+        --n_active_spares_;
+    }
+}
+
+inline void defer_pool::end_blocking() {
+    {
+        locker _(spares_lock_);
+        --n_blocked_;
+        if (!spare_surplus())
+            return;
+    }
+    // idle spares wait with the workers, let them retire
+    locker _(lock_);
+    condition_.notify_all();
+}
+
+// a busy spare retires between tasks, once its own local queue is empty
+inline bool defer_pool::try_retire(local_t* local) {
+    if (!spare_surplus())
+        return false;
+    {
+        std::lock_guard<std::mutex> _(local->lock);
+        if (!local->tasks.empty())
+            return false;
+    }
+    locker _(spares_lock_);
+    if (!spare_surplus())
+        return false;
+    --n_active_spares_;
+    return true;
+}
+
+inline void defer_pool::spare_main() {
+    std::shared_ptr<local_t> local = attach_local();
+    current() = worker_t{this, local.get(), 0};
+    exit_guard guard{this, local.get()};
+    while (run_spare(local.get())) {
+        // retired, park until the next blocking_scope needs a spare
+        locker locker_(spares_lock_);
+        ++n_parked_;
+        spare_cv_.wait(locker_, [this]() { return n_unparks_ > 0 || pool_stop_ || tasks_done_; });
+        --n_parked_;
+        if (!n_unparks_)
+            return;
+        --n_unparks_;
+    }
+}
+
+inline bool defer_pool::run_spare(local_t* local) {
+    task_node* tp = next_task(local);
+    while (true) {
+        while (tp) {
+            run_task(tp);
+            if (pool_stop_)
+                return false;
+            if (try_retire(local))
+                return true;
+            tp = next_task(local);
+        }
+        if (try_retire(local))
+            return true;
+        locker locker_(lock_);
+        ++n_idle;
+        condition_.wait(locker_, [this, &tp, local]() {
+            tp = next_task(local);
+            return pool_stop_ || tasks_done_ || tp || spare_surplus();
+        });
+        --n_idle;
+        if (!tp && (pool_stop_ || tasks_done_))
+            return false;
+    }
+}
+
+// spares finish like workers do, parked ones just exit
+inline void defer_pool::join_spares() {
+    std::vector<std::unique_ptr<std::thread>> spares;
+    {
+        locker _(spares_lock_);
+        spares.swap(spares_);
+        spare_cv_.notify_all();
+    }
+    for (auto & spare : spares)
+        spare->join();
+}
+
 #endif //DISPATCHER_DEFER_POOL_H
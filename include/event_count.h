@@ -0,0 +1,143 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_EVENT_COUNT_H
+#define DISPATCHER_EVENT_COUNT_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// hint to the cpu that we are spinning
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// lets threads block until a condition (checked by caller) may have changed,
+// notifying is a fence and a load while nobody waits
+//
+// waiter:                               notifier:
+//     auto key = ec.prepare_wait();         make condition true;
+//     if (condition) ec.cancel_wait();      ec.notify_one();
+//     else ec.wait(key);
+class event_count {
+public:
+    using key_t = uint32_t;
+
+private:
+    // low half counts waiters, high half is the epoch bumped by every notify with waiters
+    static constexpr uint64_t ADD_WAITER = 1;
+    static constexpr uint64_t WAITER_MASK = 0xffffffff;
+    static constexpr uint64_t ADD_EPOCH = uint64_t(1) << 32;
+    static constexpr int EPOCH_SHIFT = 32;
+
+public:
+    event_count() : state_(0) {}
+    // non-copyable
+    event_count(const event_count &) = delete;
+    event_count& operator=(const event_count &) = delete;
+
+    key_t prepare_wait() {
+        uint64_t prev = state_.fetch_add(ADD_WAITER, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return static_cast<key_t>(prev >> EPOCH_SHIFT);
+    }
+    void cancel_wait() {
+        state_.fetch_sub(ADD_WAITER, std::memory_order_seq_cst);
+    }
+    // block until notified after prepare_wait() returned key
+    void wait(key_t key);
+    // same, but gives up at deadline, false on timeout
+    template<typename Clock, typename Duration>
+    bool wait_until(key_t key, const std::chrono::time_point<Clock, Duration>& deadline);
+
+    // false if nobody waited, so nothing was woken
+    bool notify_one() { return notify(false); }
+    bool notify_all() { return notify(true); }
+
+private:
+    bool notify(bool all);
+    key_t epoch() const {
+        return static_cast<key_t>(state_.load(std::memory_order_acquire) >> EPOCH_SHIFT);
+    }
+#ifdef __linux__
+    // futex word is the epoch half of state_
+    int* epoch_addr() {
+        return reinterpret_cast<int*>(&state_) + (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? 1 : 0);
+    }
+#endif
+
+private:
+    std::atomic<uint64_t> state_;
+#ifndef __linux__
+    std::mutex lock_;
+    std::condition_variable condition_;
+#endif
+};
+
+inline void event_count::wait(key_t key) {
+#ifdef __linux__
+    while (epoch() == key)
+        syscall(SYS_futex, epoch_addr(), FUTEX_WAIT_PRIVATE, static_cast<int>(key), nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> locker_(lock_);
+    condition_.wait(locker_, [this, key]() { return epoch() != key; });
+#endif
+    state_.fetch_sub(ADD_WAITER, std::memory_order_seq_cst);
+}
+
+template<typename Clock, typename Duration>
+inline bool event_count::wait_until(key_t key, const std::chrono::time_point<Clock, Duration>& deadline) {
+    bool notified = true;
+#ifdef __linux__
+    while (epoch() == key) {
+        auto left = deadline - Clock::now();
+        if (left <= Duration::zero()) {
+            notified = false;
+            break;
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        timespec ts{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+        syscall(SYS_futex, epoch_addr(), FUTEX_WAIT_PRIVATE, static_cast<int>(key), &ts, nullptr, 0);
+    }
+#else
+    std::unique_lock<std::mutex> locker_(lock_);
+    notified = condition_.wait_until(locker_, deadline, [this, key]() { return epoch() != key; });
+#endif
+    state_.fetch_sub(ADD_WAITER, std::memory_order_seq_cst);
+    return notified;
+}
+
+inline bool event_count::notify(bool all) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((state_.load(std::memory_order_relaxed) & WAITER_MASK) == 0)
+        return false;
+    state_.fetch_add(ADD_EPOCH, std::memory_order_acq_rel);
+#ifdef __linux__
+    syscall(SYS_futex, epoch_addr(), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> _(lock_);
+    if (all)
+        condition_.notify_all();
+    else
+        condition_.notify_one();
+#endif
+    return true;
+}
+
+#endif //DISPATCHER_EVENT_COUNT_H
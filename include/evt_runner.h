@@ -8,9 +8,28 @@
 #include <memory>
 #include <thread>
 #include <map>
+#include <deque>
+#include <cstdint>
+#include <unordered_map>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <new>
+#include <stdexcept>
+#include "spsc_ring.h"
+#include "trace.h"
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 //######################### helper ###########################
 template<typename T>
@@ -24,22 +43,161 @@ struct is_chrono_duration<std::chrono::duration<Rep, Period>> {
 };
 //###################### end of helper ########################
 
+// timers and posted events handled on one loop thread
+//
+// posts from any thread land in the poster's inbox (an SPSC ring behind its own mutex, one
+// per hardware thread, so the mutex is normally uncontended; producers beyond that share
+// one round-robin and serialize on that inbox only, the loop takes it only for overflow),
+// the loop drains all inboxes in batches into its private timer heap, so producers never
+// wait for the loop and the heap needs no lock;
+// cancel and reschedule work from any thread through an atomic state kept per post
 template<typename EventType>
 class evt_runner {
 public:
     using callback_t = std::function<void(const EventType &)>;
-    using defer_t = std::function<void(std::unique_lock<std::mutex> &)>;
+    // single consumer which takes the payload away after all callbacks ran
+    using consumer_t = std::function<void(EventType &&)>;
+    // how posts of the same event id are merged while one is still pending
+    enum class coalesce_policy {
+        NONE,      // every post is dispatched on its own
+        LATEST,    // replace pending payload in place, keep its schedule
+        DEBOUNCE,  // replace pending payload and restart the quiet period
+        THROTTLE   // at most one dispatch per interval, latest payload wins
+    };
+
+    // what the loop thread blocks on between timers
+    enum class backend {
+        CONDVAR,  // condition variable, timers and posted events only
+#ifdef __linux__
+        REACTOR   // epoll_wait with eventfd wakeups, also dispatches fd readiness
+#endif
+    };
+    // readiness of a registered fd, events are EPOLLIN, EPOLLOUT, ... bits
+    using fd_callback_t = std::function<void(int fd, uint32_t events)>;
+
+    // refers to one pending post, stale once it fired, got cancelled or merged into a later post
+    struct handle {
+        handle() : index(0), generation(0) {}  // records start at generation 1, never valid
+        handle(uint32_t i, uint32_t g) : index(i), generation(g) {}
+        uint32_t index;
+        uint32_t generation;
+    };
 
 private:
     using locker = std::unique_lock<std::mutex>;
+    using time_point = std::chrono::time_point<std::chrono::high_resolution_clock>;
+    static constexpr uint32_t NPOS = UINT32_MAX;
+    // record index: inbox << SLOT_BITS | slot, slots come in chunks of 1 << CHUNK_BITS
+    static constexpr uint32_t SLOT_BITS = 20;
+    static constexpr uint32_t CHUNK_BITS = 10;
+    static constexpr uint32_t MAX_CHUNKS = 1u << (SLOT_BITS - CHUNK_BITS);
+    static constexpr uint32_t MAX_INBOXES = 1u << (32 - SLOT_BITS);
+    static constexpr size_t POST_CAPACITY = 512;
+    static constexpr size_t MOVE_CAPACITY = 64;
+    // messages taken from one inbox ring per loop iteration
+    static constexpr size_t DRAIN_BATCH = 256;
+    // event_record::state: generation << 32 | reschedules in flight << 2 | status
+    static constexpr uint64_t FREE = 0;
+    static constexpr uint64_t PENDING = 1;
+    static constexpr uint64_t CANCELLED = 2;
+    static constexpr uint64_t DONE = 3;  // fired, or merged into a later post
+    static constexpr uint64_t STATUS_MASK = 3;
+    static constexpr uint64_t ADD_MOVE = 4;
+    static constexpr uint64_t MOVES_MASK = 0xfffffffc;
+
+    // one per post, stays at its address for the runner's lifetime and is recycled
+    struct event_record {
+        event_record() : state(uint64_t(1) << 32), next_free(NPOS), event_id(0), coalesced(false),
+                         evt(nullptr), heap_pos(NPOS), moved(false) {}
+        std::atomic<uint64_t> state;  // any thread
+        uint32_t next_free;  // free list link, producers and loop hand it over through the inbox
+        // loop thread only
+        int event_id;
+        bool coalesced;
+        EventType* evt;  // the payload once accepted, else nullptr
+        uint32_t heap_pos;  // NPOS if not in the heap
+        bool moved;  // a reschedule got drained before the post itself
+        time_point moved_ts;
+        // built here by the producer, destroyed by the loop before the record is freed
+        typename std::aligned_storage<sizeof(EventType), alignof(EventType)>::type payload;
+        EventType* payload_ptr() { return reinterpret_cast<EventType*>(&payload); }
+    };
+    struct record_chunk {
+        event_record records[1u << CHUNK_BITS];
+    };
+    // the payload stays in the record, only its index travels
+    struct post_msg {
+        post_msg(uint32_t r, int id, time_point t) : rec(r), event_id(id), ts(t) {}
+        uint32_t rec;
+        int event_id;
+        time_point ts;
+    };
+    // a reschedule to ts, or a cancel done off the loop thread
+    struct move_msg {
+        uint32_t rec;
+        uint32_t generation;
+        time_point ts;
+        bool cancel;
+    };
+    struct inbox {
+        explicit inbox(uint32_t i)
+                : id(i), posts(POST_CAPACITY), moves(MOVE_CAPACITY), free_head(NPOS), next_slot(0),
+                  overflowing(false), returned(NPOS) {
+            for (auto &c : chunks)
+                c.store(nullptr, std::memory_order_relaxed);
+        }
+        ~inbox() {
+            for (auto &c : chunks)
+                delete c.load(std::memory_order_relaxed);
+        }
+        uint32_t const id;
+        std::mutex lock;  // producers of this inbox, the loop only for overflow
+        spsc_ring<post_msg> posts;
+        spsc_ring<move_msg> moves;
+        // under lock
+        uint32_t free_head;
+        uint32_t next_slot;
+        std::deque<post_msg> overflow_posts;  // rings were full, kept in order behind them
+        std::deque<move_msg> overflow_moves;
+        std::atomic<bool> overflowing;
+        // slots freed by the loop, producers take the whole list at once
+        std::atomic<uint32_t> returned;
+        std::atomic<record_chunk*> chunks[MAX_CHUNKS];
+    };
+    // 4-ary min heap entry, ordered by (ts, seq) so equal deadlines fire in post order
+    struct heap_entry {
+        time_point ts;
+        uint64_t seq;
+        uint32_t rec;
+    };
+    // callbacks and consumer of one event id, never changed once published: registration
+    // swaps in a new set, so a dispatch only takes a reference
+    struct handler_set {
+        std::vector<callback_t> callbacks;
+        consumer_t consumer;
+    };
+    using handlers_ptr = std::shared_ptr<const handler_set>;
+    // settings under events_lock_
+    struct coalesce_config {
+        coalesce_policy policy;
+        std::chrono::nanoseconds interval;
+    };
+    // loop thread only
+    struct coalesce_state {
+        coalesce_state() : pending(false), rec(NPOS), last_dispatch(time_point::min()) {}
+        bool pending;
+        uint32_t rec;  // valid only if pending
+        time_point last_dispatch;
+    };
 
 public:
-    evt_runner() : running_(false) {};
+    explicit evt_runner(backend b = backend::CONDVAR);
     // non-copyable
     evt_runner(const evt_runner &) = delete;
     evt_runner &operator=(const evt_runner &) = delete;
     // movable
     evt_runner(evt_runner &&) noexcept = default;
+    ~evt_runner();
 
     void start();
     void pause();
@@ -48,26 +206,224 @@ public:
     // register event and its callback
     void register_event(int event_id, callback_t function);
     void unregister_event(int event_id);
+    // register (or replace) the consumer of event_id, it gets the payload by rvalue
+    void register_consumer(int event_id, consumer_t function);
+    void unregister_consumer(int event_id);
+
+    // merge bursts of event_id into a single pending dispatch,
+    // interval is the quiet period (DEBOUNCE) or minimum spacing (THROTTLE)
+    template<typename Duration = std::chrono::milliseconds>
+    void set_coalesce(int event_id, coalesce_policy policy, int duration_value = 0);
 
     // send event for immediate execution
-    void send(int event_id, EventType evt) { post(event_id, std::move(evt), 0); }
+    handle send(int event_id, EventType evt);
     // post event for delayed execution, default duration is in milliseconds
+    // a coalesced post takes over the pending event it merges into, the earlier handle goes stale
+    template<typename Duration = std::chrono::milliseconds>
+    handle post(int event_id, EventType evt, int duration_value = 10);
+    // construct event in its record and send it for immediate execution, never copied or moved
+    template<typename ...Args>
+    handle post_emplace(int event_id, Args&& ...args);
+
+    // from the loop thread (a callback firing another event) run the callbacks inline,
+    // nested up to MAX_INLINE_DEPTH, deeper ones go to a loop-owned queue drained
+    // before the next wait, no wakeup either way; from other threads same as send
+    void dispatch(int event_id, EventType evt);
+
+    static constexpr size_t MAX_INLINE_DEPTH = 16;
+
+    // reactor backend only: call function on the loop thread whenever fd becomes ready
+    // for events (EPOLLIN, EPOLLOUT, ..., level triggered unless EPOLLET is given),
+    // registering an fd again replaces its events and callback
+    void register_fd(int fd, uint32_t events, fd_callback_t function);
+    void unregister_fd(int fd);
+
+    // drop a pending event, false if it already fired (or was cancelled)
+    // from another thread the loop frees it on its next drain
+    bool cancel(handle h);
+    // move a pending event to now + duration, false if it already fired
     template<typename Duration = std::chrono::milliseconds>
-    void post(int event_id, EventType evt, int duration_value = 10);
+    bool reschedule(handle h, int duration_value);
 
 private:
     void loop();
-    void defer(int event_id, EventType evt, locker &locker_);
+    // move inbox messages into the heap, false if there were none
+    bool drain();
+    bool has_inbound();
+    // fire the earliest timer if due, false once none is
+    bool fire_due();
+    // block until next_event or a wakeup
+    void wait_next(time_point next_event);
+    // wake loop thread out of its wait
+    void notify();
+    // store-buffer pattern with wait_next(): post published, then sleeping_ read here,
+    // sleeping_ set, then inboxes read there; the fences keep either side from reordering
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false))
+            notify();
+    }
+#ifdef __linux__
+    // block in epoll_wait until next_event, dispatching ready fds
+    void poll(time_point next_event);
+    // epoll_wait for up to timeout ms (-1 forever, 0 just a check), dispatching ready fds
+    void react(int timeout);
+#endif
+    template<typename ...Args>
+    handle emplace(int event_id, time_point ts, Args&& ...args);
+    void push_move(const move_msg& m);
+    // loop side of a message, under events_lock_ (coalesce settings)
+    void accept(post_msg& m);
+    void apply_move(const move_msg& m);
+    void schedule(uint32_t rec, int event_id, EventType* evt, time_point ts);
+    void defer(int event_id, EventType* evt, const void* id);
+    template<typename F>
+    void update_handlers(int event_id, F change);
+    // run callbacks and consumer of event_id on evt, events_lock_ only to take the set
+    void invoke(int event_id, EventType& evt);
+    void clear_events();
+
+    // runner whose loop the current thread runs, and its inline nesting
+    struct loop_ctx {
+        const evt_runner* runner;
+        size_t depth;
+    };
+    static loop_ctx& current() {
+        static thread_local loop_ctx ctx{nullptr, 0};
+        return ctx;
+    }
+
+    // records, any thread
+    // a producer keeps its inbox, so its posts stay in order
+    inbox& local_inbox();
+    event_record* record(uint32_t rec) const;
+    static uint32_t generation(uint64_t state) { return static_cast<uint32_t>(state >> 32); }
+    // records get recycled, so a post is traced by its handle (index and generation) rather
+    // than by its record's address (the generation is lost where pointers have 32 bits)
+    static const void* trace_id(uint32_t rec, uint32_t generation) {
+        return reinterpret_cast<const void*>(static_cast<uintptr_t>(uint64_t(generation) << 32 | rec));
+    }
+    // producer side, under the inbox lock
+    uint32_t alloc_slot(inbox& in);
+    // loop side
+    void free_record(uint32_t rec);
+    // pending event leaves the heap unfired
+    void drop(uint32_t rec);
+    // rec is no longer pending, false if it got cancelled meanwhile
+    bool retire(uint32_t rec);
+    void heap_push(uint32_t rec, time_point ts);
+    void heap_remove(uint32_t pos);
+    void heap_update(uint32_t pos, time_point ts);
+    void sift_up(uint32_t pos);
+    void sift_down(uint32_t pos);
+    void place(uint32_t pos, const heap_entry& e) {
+        heap_[pos] = e;
+        record(e.rec)->heap_pos = pos;
+    }
+    static bool before(const heap_entry& a, const heap_entry& b) {
+        return a.ts < b.ts || (a.ts == b.ts && a.seq < b.seq);
+    }
 
 private:
     std::atomic<bool> running_;
+    std::atomic<bool> sleeping_;  // loop thread is (about to be) blocked
     std::thread thread_;
-    std::mutex events_lock_;
+    std::mutex events_lock_;  // callbacks, consumers, coalesce settings, fds
+    std::mutex wait_lock_;
     std::condition_variable events_condition_;
-    std::multimap<int, callback_t> callbacks_;
-    std::multimap<std::chrono::time_point<std::chrono::high_resolution_clock>, defer_t> events_;
+    std::unordered_map<int, handlers_ptr> handlers_;
+    std::unordered_map<int, coalesce_config> coalesce_;
+    std::vector<std::unique_ptr<inbox>> inboxes_;
+    // loop thread only
+    std::vector<heap_entry> heap_;
+    std::deque<std::pair<int, EventType>> local_events_;  // dispatched past inline depth
+    uint64_t seq_;
+    std::unordered_map<int, coalesce_state> coalesced_;
+    backend backend_;
+    std::unordered_map<int, fd_callback_t> fds_;
+    int epoll_fd_;
+    int wake_fd_;
 };
 
+template<typename EventType>
+inline evt_runner<EventType>::evt_runner(backend b)
+        : running_(false), sleeping_(false), seq_(0), backend_(b), epoll_fd_(-1), wake_fd_(-1) {
+    size_t n = std::thread::hardware_concurrency();
+    n = n == 0 ? 1 : (n > MAX_INBOXES ? MAX_INBOXES : n);
+    for (size_t i = 0; i < n; i++)
+        inboxes_.emplace_back(new inbox(static_cast<uint32_t>(i)));
+#ifdef __linux__
+    if (b != backend::REACTOR)
+        return;
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    if (wake_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0) {
+        int err = errno;
+        if (wake_fd_ >= 0)
+            close(wake_fd_);
+        close(epoll_fd_);
+        throw std::system_error(err, std::generic_category(), "eventfd");
+    }
+#endif
+}
+
+template<typename EventType>
+inline evt_runner<EventType>::~evt_runner() {
+    clear_events();
+#ifdef __linux__
+    if (wake_fd_ >= 0)
+        close(wake_fd_);
+    if (epoll_fd_ >= 0)
+        close(epoll_fd_);
+#endif
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::notify() {
+#ifdef __linux__
+    if (backend_ == backend::REACTOR) {
+        uint64_t one = 1;
+        ssize_t _ = write(wake_fd_, &one, sizeof(one));
+        (void)_;  // counter saturated means a wakeup is pending anyway
+        return;
+    }
+#endif
+    locker _(wait_lock_);
+    events_condition_.notify_one();
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::register_fd(int fd, uint32_t events, fd_callback_t function) {
+#ifdef __linux__
+    if (backend_ != backend::REACTOR)
+        throw std::logic_error("evt_runner::register_fd needs the reactor backend");
+    locker _(events_lock_);
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    bool known = fds_.count(fd) != 0;
+    if (epoll_ctl(epoll_fd_, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0)
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+    fds_[fd] = std::move(function);
+#else
+    throw std::logic_error("evt_runner::register_fd needs the reactor backend");
+#endif
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::unregister_fd(int fd) {
+#ifdef __linux__
+    locker _(events_lock_);
+    if (fds_.erase(fd) != 0)
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);  // fails harmlessly if fd got closed already
+#endif
+}
+
 template<typename EventType>
 inline void evt_runner<EventType>::start() {
     running_ = true;
@@ -77,84 +433,656 @@ inline void evt_runner<EventType>::start() {
 template<typename EventType>
 inline void evt_runner<EventType>::pause() {
     running_ = false;
-    events_condition_.notify_one();
+    sleeping_ = false;
+    notify();
     thread_.join();
 }
 
 template<typename EventType>
 inline void evt_runner<EventType>::stop() {
-    running_ = false;
-    events_condition_.notify_one();
-    events_.clear();
-    callbacks_.clear();
-    thread_.join();
+    pause();
+    clear_events();
+    handlers_.clear();
+#ifdef __linux__
+    for (auto &f : fds_)
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, f.first, nullptr);
+#endif
+    fds_.clear();
+}
+
+// loop is not running, drop everything pending or still in the inboxes
+template<typename EventType>
+inline void evt_runner<EventType>::clear_events() {
+    while (!heap_.empty())
+        drop(heap_.back().rec);
+    for (auto &in : inboxes_) {
+        auto discard = [this](post_msg& m) {
+            record(m.rec)->payload_ptr()->~EventType();
+            free_record(m.rec);
+        };
+        while (in->posts.consume(discard, DRAIN_BATCH)) { }
+        while (in->moves.consume([](move_msg&) {}, DRAIN_BATCH)) { }
+        locker _(in->lock);
+        for (auto &m : in->overflow_posts)
+            discard(m);
+        in->overflow_posts.clear();
+        in->overflow_moves.clear();
+        in->overflowing = false;
+    }
+    local_events_.clear();
+    coalesced_.clear();
 }
 
 template<typename EventType>
 inline void evt_runner<EventType>::register_event(int event_id, evt_runner::callback_t function) {
-    locker _(events_lock_);
-    callbacks_.insert(std::make_pair(event_id, std::move(function)));
+    update_handlers(event_id, [&function](handler_set& h) { h.callbacks.push_back(std::move(function)); });
 }
 
 template<typename EventType>
 inline void evt_runner<EventType>::unregister_event(int event_id) {
+    update_handlers(event_id, [](handler_set& h) { h.callbacks.clear(); });
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::register_consumer(int event_id, evt_runner::consumer_t function) {
+    update_handlers(event_id, [&function](handler_set& h) { h.consumer = std::move(function); });
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::unregister_consumer(int event_id) {
+    update_handlers(event_id, [](handler_set& h) { h.consumer = nullptr; });
+}
+
+// copy, change and swap in, a dispatch still running the old set keeps it alive
+template<typename EventType>
+template<typename F>
+inline void evt_runner<EventType>::update_handlers(int event_id, F change) {
     locker _(events_lock_);
-    callbacks_.erase(event_id);
+    auto it = handlers_.find(event_id);
+    std::shared_ptr<handler_set> next = it == handlers_.end() ? std::make_shared<handler_set>()
+                                                              : std::make_shared<handler_set>(*it->second);
+    change(*next);
+    if (next->callbacks.empty() && !next->consumer)
+        handlers_.erase(event_id);
+    else
+        handlers_[event_id] = std::move(next);
 }
 
 template<typename EventType>
 template<typename Duration>
-inline void evt_runner<EventType>::post(int event_id, EventType evt, int duration_value) {
+inline void evt_runner<EventType>::set_coalesce(int event_id, coalesce_policy policy, int duration_value) {
+    static_assert(is_chrono_duration<Duration>::value, "Duration must be a std::chrono::duration");
+    locker _(events_lock_);
+    // pending event (if any) stays scheduled, with NONE it fires as a plain one
+    if (policy == coalesce_policy::NONE)
+        coalesce_.erase(event_id);
+    else
+        coalesce_[event_id] = coalesce_config{policy, Duration(duration_value)};
+}
+
+template<typename EventType>
+inline typename evt_runner<EventType>::handle
+evt_runner<EventType>::send(int event_id, EventType evt) {
+    // straight to the record, one move fewer than going through post
+    return emplace(event_id, std::chrono::high_resolution_clock::now(), std::move(evt));
+}
+
+template<typename EventType>
+template<typename Duration>
+inline typename evt_runner<EventType>::handle
+evt_runner<EventType>::post(int event_id, EventType evt, int duration_value) {
     static_assert(is_chrono_duration<Duration>::value, "Duration must be a std::chrono::duration");
     auto duration = Duration(duration_value);
+    return emplace(event_id, std::chrono::high_resolution_clock::now() + duration, std::move(evt));
+}
+
+template<typename EventType>
+template<typename ...Args>
+inline typename evt_runner<EventType>::handle
+evt_runner<EventType>::post_emplace(int event_id, Args&& ...args) {
+    return emplace(event_id, std::chrono::high_resolution_clock::now(), std::forward<Args>(args)...);
+}
+
+template<typename EventType>
+inline typename evt_runner<EventType>::inbox& evt_runner<EventType>::local_inbox() {
+    static std::atomic<size_t> next(0);
+    static thread_local size_t i = next.fetch_add(1, std::memory_order_relaxed);
+    return *inboxes_[i % inboxes_.size()];
+}
+
+template<typename EventType>
+template<typename ...Args>
+inline typename evt_runner<EventType>::handle
+evt_runner<EventType>::emplace(int event_id, time_point ts, Args&& ...args) {
+    inbox& in = local_inbox();
+    handle h;
     {
-        locker _(events_lock_);
-        events_.insert(std::make_pair(std::move(std::chrono::high_resolution_clock::now() + duration),
-                                      std::bind(&evt_runner::defer,
-                                                this, event_id, std::move(evt), std::placeholders::_1)));
+        locker _(in.lock);
+        uint32_t slot = alloc_slot(in);
+        h.index = in.id << SLOT_BITS | slot;
+        event_record* r = record(h.index);
+        h.generation = generation(r->state.load(std::memory_order_relaxed));
+        r->state.store(uint64_t(h.generation) << 32 | PENDING, std::memory_order_relaxed);
+        bool built = false;
+        try {
+            // the payload is built where callbacks will see it, nothing copies or moves it later
+            new (&r->payload) EventType(std::forward<Args>(args)...);
+            built = true;
+            // keep order behind overflowed posts, the ring push publishes the record
+            if (in.overflowing || !in.posts.try_emplace(h.index, event_id, ts)) {
+                in.overflow_posts.emplace_back(h.index, event_id, ts);
+                in.overflowing = true;
+            }
+        } catch (...) {
+            if (built)
+                r->payload_ptr()->~EventType();
+            r->state.store(uint64_t(h.generation) << 32 | FREE, std::memory_order_relaxed);
+            r->next_free = in.free_head;
+            in.free_head = slot;
+            throw;
+        }
+        DISPATCHER_TRACE_EVENT(ENQUEUE, "evt_runner", this, trace_id(h.index, h.generation));
     }
     // wake up when new event coming
-    events_condition_.notify_one();
+    wake();
+    return h;
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::push_move(const move_msg& m) {
+    inbox& in = local_inbox();
+    {
+        locker _(in.lock);
+        if (in.overflowing || !in.moves.try_push(m)) {
+            in.overflow_moves.push_back(m);
+            in.overflowing = true;
+        }
+    }
+    wake();
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::dispatch(int event_id, EventType evt) {
+    loop_ctx& ctx = current();
+    if (ctx.runner != this) {
+        send(event_id, std::move(evt));
+        return;
+    }
+    if (ctx.depth >= MAX_INLINE_DEPTH) {
+        local_events_.emplace_back(event_id, std::move(evt));
+        return;
+    }
+    ++ctx.depth;
+    struct depth_guard {
+        loop_ctx& ctx;
+        ~depth_guard() { --ctx.depth; }
+    } _{ctx};
+    invoke(event_id, evt);
+}
+
+template<typename EventType>
+inline bool evt_runner<EventType>::cancel(handle h) {
+    event_record* r = record(h.index);
+    if (!r)
+        return false;
+    uint64_t s = r->state.load(std::memory_order_acquire);
+    do {
+        if (generation(s) != h.generation || (s & STATUS_MASK) != PENDING)
+            return false;
+    } while (!r->state.compare_exchange_weak(s, (s & ~STATUS_MASK) | CANCELLED, std::memory_order_acq_rel));
+    // the heap is ours on the loop thread, drop it right away, else the loop does
+    if (current().runner != this)
+        push_move(move_msg{h.index, h.generation, time_point(), true});
+    else if (r->heap_pos != NPOS)
+        drop(h.index);
+    return true;
+}
+
+template<typename EventType>
+template<typename Duration>
+inline bool evt_runner<EventType>::reschedule(handle h, int duration_value) {
+    static_assert(is_chrono_duration<Duration>::value, "Duration must be a std::chrono::duration");
+    auto ts = std::chrono::high_resolution_clock::now() + Duration(duration_value);
+    event_record* r = record(h.index);
+    if (!r)
+        return false;
+    // counted in flight, the loop holds the event back until the move arrives
+    uint64_t s = r->state.load(std::memory_order_acquire);
+    do {
+        if (generation(s) != h.generation || (s & STATUS_MASK) != PENDING)
+            return false;
+    } while (!r->state.compare_exchange_weak(s, s + ADD_MOVE, std::memory_order_acq_rel));
+    push_move(move_msg{h.index, h.generation, ts, false});
+    return true;
+}
+
+template<typename EventType>
+inline typename evt_runner<EventType>::event_record* evt_runner<EventType>::record(uint32_t rec) const {
+    uint32_t in = rec >> SLOT_BITS;
+    if (in >= inboxes_.size())
+        return nullptr;
+    uint32_t slot = rec & ((1u << SLOT_BITS) - 1);
+    record_chunk* c = inboxes_[in]->chunks[slot >> CHUNK_BITS].load(std::memory_order_acquire);
+    return c ? &c->records[slot & ((1u << CHUNK_BITS) - 1)] : nullptr;
+}
+
+template<typename EventType>
+inline uint32_t evt_runner<EventType>::alloc_slot(inbox& in) {
+    if (in.free_head == NPOS)
+        in.free_head = in.returned.exchange(NPOS, std::memory_order_acquire);
+    if (in.free_head != NPOS) {
+        uint32_t slot = in.free_head;
+        in.free_head = record(in.id << SLOT_BITS | slot)->next_free;
+        return slot;
+    }
+    if (in.next_slot >> SLOT_BITS)
+        throw std::length_error("evt_runner: too many pending events");
+    uint32_t slot = in.next_slot++;
+    if ((slot & ((1u << CHUNK_BITS) - 1)) == 0)
+        in.chunks[slot >> CHUNK_BITS].store(new record_chunk, std::memory_order_release);
+    return slot;
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::free_record(uint32_t rec) {
+    event_record& r = *record(rec);
+    r.heap_pos = NPOS;
+    r.evt = nullptr;
+    r.moved = false;
+    // outstanding handles go stale, moves in flight are dropped with them
+    uint32_t g = generation(r.state.load(std::memory_order_relaxed)) + 1;
+    r.state.store(uint64_t(g == 0 ? 1 : g) << 32 | FREE, std::memory_order_release);
+    inbox& in = *inboxes_[rec >> SLOT_BITS];
+    uint32_t slot = rec & ((1u << SLOT_BITS) - 1);
+    uint32_t head = in.returned.load(std::memory_order_relaxed);
+    do {
+        r.next_free = head;
+    } while (!in.returned.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::drop(uint32_t rec) {
+    event_record& r = *record(rec);
+    if (r.coalesced) {
+        auto c = coalesced_.find(r.event_id);
+        if (c != coalesced_.end() && c->second.pending && c->second.rec == rec)
+            c->second.pending = false;
+    }
+    r.evt->~EventType();
+    heap_remove(r.heap_pos);
+    free_record(rec);
+}
+
+template<typename EventType>
+inline bool evt_runner<EventType>::retire(uint32_t rec) {
+    event_record& r = *record(rec);
+    uint64_t s = r.state.load(std::memory_order_acquire);
+    do {
+        if ((s & STATUS_MASK) == CANCELLED)
+            return false;
+    } while (!r.state.compare_exchange_weak(s, (s & ~(STATUS_MASK | MOVES_MASK)) | DONE, std::memory_order_acq_rel));
+    return true;
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::heap_push(uint32_t rec, time_point ts) {
+    heap_.push_back(heap_entry{ts, seq_++, rec});
+    place(static_cast<uint32_t>(heap_.size() - 1), heap_.back());
+    sift_up(static_cast<uint32_t>(heap_.size() - 1));
+}
+
+// entry leaves the heap, its record keeps no heap position
+template<typename EventType>
+inline void evt_runner<EventType>::heap_remove(uint32_t pos) {
+    record(heap_[pos].rec)->heap_pos = NPOS;
+    uint32_t last = static_cast<uint32_t>(heap_.size() - 1);
+    if (pos != last) {
+        uint32_t moved = heap_[last].rec;
+        place(pos, heap_[last]);
+        heap_.pop_back();
+        sift_up(pos);
+        sift_down(record(moved)->heap_pos);
+    } else {
+        heap_.pop_back();
+    }
+}
+
+// new deadline goes behind events already due at the same time
+template<typename EventType>
+inline void evt_runner<EventType>::heap_update(uint32_t pos, time_point ts) {
+    heap_[pos].ts = ts;
+    heap_[pos].seq = seq_++;
+    sift_up(pos);
+    sift_down(pos);
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::sift_up(uint32_t pos) {
+    heap_entry e = heap_[pos];
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 4;
+        if (!before(e, heap_[parent]))
+            break;
+        place(pos, heap_[parent]);
+        pos = parent;
+    }
+    place(pos, e);
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::sift_down(uint32_t pos) {
+    heap_entry e = heap_[pos];
+    uint32_t n = static_cast<uint32_t>(heap_.size());
+    while (true) {
+        uint32_t first = pos * 4 + 1;
+        if (first >= n)
+            break;
+        uint32_t last = first + 4 < n ? first + 4 : n;
+        uint32_t min = first;
+        for (uint32_t c = first + 1; c < last; c++)
+            if (before(heap_[c], heap_[min]))
+                min = c;
+        if (!before(heap_[min], e))
+            break;
+        place(pos, heap_[min]);
+        pos = min;
+    }
+    place(pos, e);
+}
+
+template<typename EventType>
+inline bool evt_runner<EventType>::drain() {
+    bool any = false;
+    locker _(events_lock_);
+    for (auto &in : inboxes_) {
+        if (in->posts.consume([this](post_msg& m) { accept(m); }, DRAIN_BATCH))
+            any = true;
+        if (in->moves.consume([this](move_msg& m) { apply_move(m); }, DRAIN_BATCH))
+            any = true;
+        // overflow is newer than anything in the rings, take it once they ran empty
+        if (in->overflowing && in->posts.empty() && in->moves.empty()) {
+            locker l(in->lock);
+            for (auto &m : in->overflow_posts)
+                accept(m);
+            for (auto &m : in->overflow_moves)
+                apply_move(m);
+            in->overflow_posts.clear();
+            in->overflow_moves.clear();
+            in->overflowing = false;
+            any = true;
+        }
+    }
+    return any;
+}
+
+template<typename EventType>
+inline bool evt_runner<EventType>::has_inbound() {
+    for (auto &in : inboxes_)
+        if (!in->posts.empty() || !in->moves.empty() || in->overflowing)
+            return true;
+    return false;
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::accept(post_msg& m) {
+    event_record& r = *record(m.rec);
+    if ((r.state.load(std::memory_order_acquire) & STATUS_MASK) == CANCELLED) {
+        r.payload_ptr()->~EventType();
+        free_record(m.rec);
+        return;
+    }
+    EventType* evt = r.payload_ptr();
+    time_point ts = r.moved ? r.moved_ts : m.ts;
+    r.moved = false;
+    schedule(m.rec, m.event_id, evt, ts);
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::apply_move(const move_msg& m) {
+    event_record& r = *record(m.rec);
+    uint64_t s = r.state.load(std::memory_order_acquire);
+    if (m.cancel) {
+        // still cancelled in the same generation, so not freed yet; a post still in
+        // another inbox is freed by accept()
+        if (generation(s) == m.generation && (s & STATUS_MASK) == CANCELLED && r.heap_pos != NPOS)
+            drop(m.rec);
+        return;
+    }
+    do {
+        // freed meanwhile, its moves went with it
+        if (generation(s) != m.generation)
+            return;
+    } while (!r.state.compare_exchange_weak(s, s - ADD_MOVE, std::memory_order_acq_rel));
+    if ((s & STATUS_MASK) != PENDING)
+        return;
+    if (r.heap_pos == NPOS) {
+        // post still in another inbox
+        r.moved = true;
+        r.moved_ts = m.ts;
+    } else {
+        heap_update(r.heap_pos, m.ts);
+    }
+}
+
+// must hold events_lock_
+template<typename EventType>
+inline void evt_runner<EventType>::schedule(uint32_t rec, int event_id, EventType* evt, time_point ts) {
+    event_record& r = *record(rec);
+    r.event_id = event_id;
+    r.evt = evt;
+    auto c = coalesce_.find(event_id);
+    r.coalesced = c != coalesce_.end();
+    if (!r.coalesced) {
+        heap_push(rec, ts);
+        return;
+    }
+    auto &config = c->second;
+    auto &state = coalesced_[event_id];
+    // pending one cancelled from another thread is still in the heap
+    if (state.pending && (record(state.rec)->state.load() & STATUS_MASK) == CANCELLED) {
+        drop(state.rec);
+        state.pending = false;
+    }
+    switch (config.policy) {
+        case coalesce_policy::DEBOUNCE: {
+            // quiet period restarts from the latest post
+            auto quiet = std::chrono::high_resolution_clock::now() + config.interval;
+            if (ts < quiet)
+                ts = quiet;
+            break;
+        }
+        case coalesce_policy::THROTTLE:
+            if (!state.pending && ts < state.last_dispatch + config.interval)
+                ts = state.last_dispatch + config.interval;
+            break;
+        default:
+            break;
+    }
+    // take over the pending dispatch: LATEST and THROTTLE keep its schedule, DEBOUNCE restarts it
+    if (state.pending && retire(state.rec)) {
+        event_record& p = *record(state.rec);
+        uint32_t pos = p.heap_pos;
+        p.evt->~EventType();
+        p.heap_pos = NPOS;
+        free_record(state.rec);
+        heap_[pos].rec = rec;
+        r.heap_pos = pos;
+        state.rec = rec;
+        if (config.policy == coalesce_policy::DEBOUNCE)
+            heap_update(pos, ts);
+        return;
+    }
+    if (state.pending)
+        drop(state.rec);  // cancelled just now
+    heap_push(rec, ts);
+    state.pending = true;
+    state.rec = rec;
 }
 
 template<typename EventType>
 inline void evt_runner<EventType>::loop() {
-    locker locker_(events_lock_);
+    current() = loop_ctx{this, 0};
     while (running_) {
-        auto next_event = std::chrono::time_point<std::chrono::high_resolution_clock>::max();
-        if (!events_.empty())
-            next_event = events_.begin()->first;
-        // wait until:
-        // 1. new event coming
-        // 2. terminate or event with smaller timestamp detected when refresh events
-        events_condition_.wait_until(locker_, next_event, [&]() {
-            return !running_ || (!events_.empty() && events_.begin()->first < next_event);
-        });
-        if (next_event <= std::chrono::high_resolution_clock::now()) {
-            auto it = events_.begin();
-            auto func = it->second;
-            events_.erase(it);
-            // temporarily releases lock
-            func(locker_);
+        drain();
+        // locally dispatched events are due already, run the ones queued so far
+        for (size_t n = local_events_.size(); n > 0 && running_; n--) {
+            std::pair<int, EventType> e(std::move(local_events_.front()));
+            local_events_.pop_front();
+            invoke(e.first, e.second);
+        }
+        while (running_ && fire_due()) { }
+        auto next_event = time_point::max();
+        if (!local_events_.empty())
+            next_event = std::chrono::high_resolution_clock::now();  // more got queued, no sleep
+        else if (!heap_.empty())
+            next_event = heap_.front().ts;
+        wait_next(next_event);
+    }
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::wait_next(time_point next_event) {
+#ifdef __linux__
+    // a loop kept busy by posts or timers never sleeps in poll(), serve ready fds anyway
+    bool reactor = backend_ == backend::REACTOR;
+#endif
+    if (next_event <= std::chrono::high_resolution_clock::now()) {
+#ifdef __linux__
+        if (reactor)
+            react(0);
+#endif
+        // head is held back by a reschedule on its way, or more work is due
+        std::this_thread::yield();
+        return;
+    }
+    // announce sleep first, then re-check inboxes so no post is missed
+    sleeping_ = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!running_ || has_inbound()) {
+        sleeping_ = false;
+#ifdef __linux__
+        if (reactor && running_)
+            react(0);
+#endif
+        return;
+    }
+#ifdef __linux__
+    if (reactor) {
+        poll(next_event);
+        sleeping_ = false;
+        return;
+    }
+#endif
+    // wait until:
+    // 1. new event or reschedule coming
+    // 2. terminate or the earliest timer is due
+    locker locker_(wait_lock_);
+    events_condition_.wait_until(locker_, next_event, [this]() { return !sleeping_ || !running_; });
+    sleeping_ = false;
+}
+
+template<typename EventType>
+inline bool evt_runner<EventType>::fire_due() {
+    auto now = std::chrono::high_resolution_clock::now();
+    if (heap_.empty() || heap_.front().ts > now)
+        return false;
+    uint32_t rec = heap_.front().rec;
+    event_record& r = *record(rec);
+    uint64_t s = r.state.load(std::memory_order_acquire);
+    do {
+        if ((s & STATUS_MASK) == CANCELLED) {
+            drop(rec);
+            return true;
+        }
+        if (s & MOVES_MASK)
+            return false;  // a reschedule decides when it fires
+    } while (!r.state.compare_exchange_weak(s, (s & ~STATUS_MASK) | DONE, std::memory_order_acq_rel));
+    int event_id = r.event_id;
+    EventType* evt = r.evt;
+    const void* id = trace_id(rec, generation(s));
+    if (r.coalesced) {
+        auto c = coalesced_.find(event_id);
+        if (c != coalesced_.end() && c->second.pending && c->second.rec == rec) {
+            c->second.pending = false;
+            c->second.last_dispatch = now;
         }
     }
+    heap_remove(0);
+    DISPATCHER_TRACE_EVENT(DEQUEUE, "evt_runner", this, id);
+    // the payload lives in the record, which is freed only after the callbacks ran
+    defer(event_id, evt, id);
+    free_record(rec);
+    return true;
+}
+
+#ifdef __linux__
+template<typename EventType>
+inline void evt_runner<EventType>::poll(time_point next_event) {
+    // epoll_wait counts in milliseconds, round up so timers never fire early
+    int timeout = -1;
+    if (next_event != time_point::max()) {
+        auto left = next_event - std::chrono::high_resolution_clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(left);
+        if (ms < left)
+            ms += std::chrono::milliseconds(1);
+        timeout = ms.count() <= 0 ? 0 : (ms.count() > INT_MAX ? INT_MAX : static_cast<int>(ms.count()));
+    }
+    react(timeout);
 }
 
 template<typename EventType>
-inline void evt_runner<EventType>::defer(int event_id, EventType evt, evt_runner::locker &locker_) {
-    // make a copy in case events changed
-    auto range = callbacks_.equal_range(event_id);
-    std::vector<callback_t> functions;
-    for (auto it = range.first; it != range.second; it++) {
-        functions.push_back(it->second);
+inline void evt_runner<EventType>::react(int timeout) {
+    epoll_event ready[64];
+    int n = running_ ? epoll_wait(epoll_fd_, ready, 64, timeout) : 0;
+    for (int i = 0; i < n && running_; i++) {
+        int fd = ready[i].data.fd;
+        if (fd == wake_fd_) {
+            uint64_t count;
+            ssize_t _ = read(wake_fd_, &count, sizeof(count));
+            (void)_;
+            continue;
+        }
+        // copy in case it gets unregistered meanwhile, skip if already gone
+        fd_callback_t function;
+        {
+            locker _(events_lock_);
+            auto it = fds_.find(fd);
+            if (it == fds_.end())
+                continue;
+            function = it->second;
+        }
+        function(fd, ready[i].events);
+    }
+}
+#endif
+
+template<typename EventType>
+inline void evt_runner<EventType>::defer(int event_id, EventType* evt, const void* id) {
+    (void)id;
+    DISPATCHER_TRACE_EVENT(START, "evt_runner", this, id);
+    invoke(event_id, *evt);
+    DISPATCHER_TRACE_EVENT(FINISH, "evt_runner", this, id);
+    evt->~EventType();
+}
+
+template<typename EventType>
+inline void evt_runner<EventType>::invoke(int event_id, EventType& evt) {
+    // take a reference to the current set in case events change, no copy of the callbacks
+    handlers_ptr handlers;
+    {
+        locker _(events_lock_);
+        auto it = handlers_.find(event_id);
+        if (it == handlers_.end())
+            return;
+        handlers = it->second;
     }
-    // run copy without lock
-    locker_.unlock();
-    for (auto &function: functions) {
+    // run without lock
+    for (auto &function: handlers->callbacks) {
         function(evt);
     }
-    // afterwards lock again
-    locker_.lock();
+    // consumer runs last since it may move the payload away
+    if (handlers->consumer)
+        handlers->consumer(std::move(evt));
 }
 
 #endif //DISPATCHER_EVT_RUNNER_H
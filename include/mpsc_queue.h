@@ -0,0 +1,78 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_MPSC_QUEUE_H
+#define DISPATCHER_MPSC_QUEUE_H
+
+#include <atomic>
+
+// link embedded in every queued item
+struct mpsc_node {
+    std::atomic<mpsc_node*> next_;
+    mpsc_node() : next_(nullptr) {}
+};
+
+// intrusive lock-free multi-producer single-consumer queue (Dmitry Vyukov's algorithm)
+// T must derive from mpsc_node, queue never owns the items
+// push is wait-free for producers, pop/empty must be called by one consumer at a time
+template<typename T>
+class mpsc_queue {
+public:
+    mpsc_queue() : head_(&stub_), tail_(&stub_) {}
+    // non-copyable
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue& operator=(const mpsc_queue &) = delete;
+
+    // any thread
+    void push(T* item) { push_node(item); }
+
+    // consumer only, returns nullptr if empty or the next producer
+    // has not finished linking its item yet (check empty() to tell apart)
+    T* pop() {
+        mpsc_node* tail = tail_;
+        mpsc_node* next = tail->next_.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next)
+                return nullptr;
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+        // tail is the last linked item, producer may be in the middle of push
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+        push_node(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+        return nullptr;
+    }
+
+    // consumer only, seq_cst load of head pairs with producers'
+    // exchange so a sleeping consumer never misses a push
+    bool empty() const {
+        return tail_ == &stub_ && head_.load(std::memory_order_seq_cst) == &stub_;
+    }
+
+private:
+    void push_node(mpsc_node* n) {
+        n->next_.store(nullptr, std::memory_order_relaxed);
+        mpsc_node* prev = head_.exchange(n, std::memory_order_seq_cst);
+        prev->next_.store(n, std::memory_order_release);
+    }
+
+private:
+    std::atomic<mpsc_node*> head_;  // producers side
+    char pad_[64 - sizeof(std::atomic<mpsc_node*>)];
+    mpsc_node* tail_;  // consumer side
+    mpsc_node stub_;
+};
+
+#endif //DISPATCHER_MPSC_QUEUE_H
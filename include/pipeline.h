@@ -0,0 +1,254 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_PIPELINE_H
+#define DISPATCHER_PIPELINE_H
+
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "defer_pool.h"
+#include "wait_group.h"
+
+// items pulled from a serial source and pushed through a chain of stages on a defer_pool,
+// at most max_tokens items in flight (memory stays bounded by the token count)
+//
+// a worker carries its item from stage to stage itself, only an item blocked at a busy
+// serial stage is handed over (through the worker's local queue) to resume later
+template<typename T>
+class pipeline {
+public:
+    enum class stage_mode {
+        SERIAL_IN_ORDER,      // one item at a time, in source order
+        SERIAL_OUT_OF_ORDER,  // one item at a time, any order
+        PARALLEL              // any number of items at once
+    };
+    // fills the next item, false once input is exhausted
+    using source_t = std::function<bool(T&)>;
+    using filter_t = std::function<void(T&)>;
+
+private:
+    struct token {
+        T item;
+        size_t seq;     // position in source order
+        size_t stage;   // next stage to run
+        bool entered;   // already owns the serial stage it resumes at
+        bool failed;    // a stage threw, skip the remaining filters
+    };
+    struct stage {
+        stage(stage_mode m, filter_t fn) : mode(m), f(std::move(fn)), busy(false), next_seq(0) {}
+        stage_mode const mode;
+        filter_t const f;
+        std::mutex lock;
+        bool busy;
+        size_t next_seq;                // SERIAL_IN_ORDER only
+        std::vector<token*> in_order;   // blocked items, slot seq % max_tokens
+        std::deque<token*> out_of_order;
+    };
+
+public:
+    explicit pipeline(defer_pool& pool) : pool_(pool), max_tokens_(0), next_seq_(0), input_done_(false) {}
+    // non-copyable
+    pipeline(const pipeline &) = delete;
+    pipeline& operator=(const pipeline &) = delete;
+
+    pipeline& add_stage(stage_mode mode, filter_t f) {
+        stages_.emplace_back(new stage(mode, std::move(f)));
+        return *this;
+    }
+
+    // blocks until every item went through all stages (helping if called on a pool worker),
+    // rethrows the first exception of source or stages, no new items are pulled after it
+    void run(source_t source, size_t max_tokens);
+
+private:
+    void drive(token* t);
+    // run t through its remaining stages, false if it got blocked at a serial stage
+    bool advance(token* t);
+    bool enter(stage& s, token* t);
+    void leave(stage& s);
+    void apply(stage& s, token* t);
+    // recycle t, returns the next item to carry on with (nullptr if none)
+    token* finish(token* t);
+    token* pull_locked();
+    void fail(std::exception_ptr e);
+
+private:
+    defer_pool& pool_;
+    std::vector<std::unique_ptr<stage>> stages_;
+    size_t max_tokens_;
+    std::unique_ptr<token[]> tokens_;
+    std::mutex input_lock_;  // source, free_, next_seq_, input_done_, error_
+    source_t source_;
+    std::vector<token*> free_;
+    size_t next_seq_;
+    bool input_done_;
+    std::exception_ptr error_;
+    wait_group in_flight_;
+};
+
+template<typename T>
+inline void pipeline<T>::run(source_t source, size_t max_tokens) {
+    assert(max_tokens > 0 && pool_.size() > 0);
+    max_tokens_ = max_tokens;
+    tokens_.reset(new token[max_tokens]);
+    free_.clear();
+    for (size_t i = max_tokens; i > 0; i--)
+        free_.push_back(&tokens_[i - 1]);
+    for (auto & s : stages_) {
+        s->busy = false;
+        s->next_seq = 0;
+        s->in_order.assign(max_tokens, nullptr);
+        s->out_of_order.clear();
+    }
+    source_ = std::move(source);
+    next_seq_ = 0;
+    input_done_ = false;
+    error_ = nullptr;
+    // fill the pipeline, afterwards every finished item pulls the next one
+    for (size_t i = 0; i < max_tokens; i++) {
+        token* t;
+        {
+            std::lock_guard<std::mutex> _(input_lock_);
+            t = pull_locked();
+        }
+        if (!t)
+            break;
+        pool_.execute([this, t]() { drive(t); });
+    }
+    pool_.wait(in_flight_);
+    source_ = nullptr;
+    if (error_)
+        std::rethrow_exception(error_);
+}
+
+template<typename T>
+inline void pipeline<T>::drive(token* t) {
+    while (t && advance(t))
+        t = finish(t);
+}
+
+template<typename T>
+inline bool pipeline<T>::advance(token* t) {
+    for (; t->stage < stages_.size(); ++t->stage) {
+        stage& s = *stages_[t->stage];
+        if (s.mode == stage_mode::PARALLEL) {
+            apply(s, t);
+            continue;
+        }
+        if (!t->entered && !enter(s, t))
+            return false;
+        t->entered = false;
+        apply(s, t);
+        leave(s);
+    }
+    return true;
+}
+
+template<typename T>
+inline bool pipeline<T>::enter(stage& s, token* t) {
+    std::lock_guard<std::mutex> _(s.lock);
+    bool in_order = s.mode == stage_mode::SERIAL_IN_ORDER;
+    if (!s.busy && (!in_order || t->seq == s.next_seq)) {
+        s.busy = true;
+        return true;
+    }
+    if (in_order)
+        s.in_order[t->seq % max_tokens_] = t;
+    else
+        s.out_of_order.push_back(t);
+    return false;
+}
+
+// hand the stage over to the next blocked item, if there is one
+template<typename T>
+inline void pipeline<T>::leave(stage& s) {
+    token* next = nullptr;
+    {
+        std::lock_guard<std::mutex> _(s.lock);
+        if (s.mode == stage_mode::SERIAL_IN_ORDER) {
+            ++s.next_seq;
+            token*& slot = s.in_order[s.next_seq % max_tokens_];
+            if (slot && slot->seq == s.next_seq) {
+                next = slot;
+                slot = nullptr;
+            }
+        } else if (!s.out_of_order.empty()) {
+            next = s.out_of_order.front();
+            s.out_of_order.pop_front();
+        }
+        // stays busy on behalf of next
+        s.busy = next != nullptr;
+    }
+    if (next) {
+        next->entered = true;
+        pool_.execute([this, next]() { drive(next); });
+    }
+}
+
+template<typename T>
+inline void pipeline<T>::apply(stage& s, token* t) {
+    if (t->failed)
+        return;
+    try {
+        s.f(t->item);
+    } catch (...) {
+        t->failed = true;
+        fail(std::current_exception());
+    }
+}
+
+template<typename T>
+inline typename pipeline<T>::token* pipeline<T>::finish(token* t) {
+    token* next;
+    {
+        std::lock_guard<std::mutex> _(input_lock_);
+        free_.push_back(t);
+        next = pull_locked();
+    }
+    // next (if any) was counted in before, so the group can not drain in between
+    in_flight_.done();
+    return next;
+}
+
+// must hold input_lock_, source runs serially in order
+template<typename T>
+inline typename pipeline<T>::token* pipeline<T>::pull_locked() {
+    if (input_done_ || free_.empty())
+        return nullptr;
+    token* t = free_.back();
+    try {
+        if (!source_(t->item)) {
+            input_done_ = true;
+            return nullptr;
+        }
+    } catch (...) {
+        input_done_ = true;
+        if (!error_)
+            error_ = std::current_exception();
+        return nullptr;
+    }
+    free_.pop_back();
+    t->seq = next_seq_++;
+    t->stage = 0;
+    t->entered = false;
+    t->failed = false;
+    in_flight_.add();
+    return t;
+}
+
+template<typename T>
+inline void pipeline<T>::fail(std::exception_ptr e) {
+    std::lock_guard<std::mutex> _(input_lock_);
+    input_done_ = true;
+    if (!error_)
+        error_ = e;
+}
+
+#endif //DISPATCHER_PIPELINE_H
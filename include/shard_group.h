@@ -0,0 +1,284 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_SHARD_GROUP_H
+#define DISPATCHER_SHARD_GROUP_H
+
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "event_count.h"
+#include "mpsc_queue.h"
+#include "spsc_ring.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// shared-nothing thread-per-core executor: one thread per shard (pinned to a core
+// if asked), shards talk through an N x N mesh of SPSC rings, ring [from][to] only
+// carries tasks submitted on shard from for shard to, so unrelated pairs never touch
+// the same cache line and no sender contends with another
+//
+// submissions from threads outside the group go through a lock-free MPSC intake
+// per shard; a sender whose ring is full parks the task in its own overflow list
+// and flushes it before polling again, so submit_to never blocks
+class shard_group {
+public:
+    using task_t = std::function<void()>;
+    // tasks taken from one inbox before moving on to the next
+    static constexpr size_t BATCH = 32;
+    // empty polls before a shard goes to sleep
+    static constexpr size_t SPIN = 256;
+
+private:
+    struct remote_node : mpsc_node {
+        explicit remote_node(task_t&& t) : task(std::move(t)) {}
+        task_t task;
+    };
+    static constexpr size_t LINE = 64;
+    // one allocation each, padded on both ends (new ignores alignas beyond max_align_t
+    // before C++17) so no neighbouring allocation shares a line with its hot members
+    struct shard {
+        explicit shard(size_t n_shards) : overflow(n_shards), n_overflow(0), overflowing(false) {}
+        char pad0_[LINE];
+        std::thread thread;
+        event_count wakeup;
+        mpsc_queue<remote_node> remote;
+        // owner only: tasks for each destination whose ring was full
+        std::vector<std::deque<task_t>> overflow;
+        size_t n_overflow;
+        // lets a consumer know the owner waits for ring space
+        std::atomic<bool> overflowing;
+        char pad1_[LINE];
+    };
+    struct shard_ctx {
+        shard_group* group;
+        size_t index;
+    };
+
+public:
+    explicit shard_group(size_t n_shards = default_shards(), size_t ring_capacity = 1024, bool pin = true);
+    // non-copyable
+    shard_group(const shard_group &) = delete;
+    shard_group& operator=(const shard_group &) = delete;
+    // non-movable
+    shard_group(shard_group &&) = delete;
+    shard_group& operator=(shard_group &&) = delete;
+    ~shard_group();
+
+    void start();
+    // tasks still queued stay there and run after the next start()
+    void stop();
+
+    // run f on shard to, from any thread (lock-free from a shard, wait-free from outside)
+    template<typename F, typename ...Args>
+    void submit_to(size_t to, F&& f, Args&& ...args);
+    template<typename F>
+    void submit_to(size_t to, F&& f);
+
+    size_t size() const { return shards_.size(); }
+    // shard of this group the calling thread runs, -1 if none
+    int this_shard() const {
+        const shard_ctx& ctx = current();
+        return ctx.group == this ? static_cast<int>(ctx.index) : -1;
+    }
+
+    static size_t default_shards() {
+        size_t n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : n;
+    }
+
+private:
+    static shard_ctx& current() {
+        static thread_local shard_ctx ctx{nullptr, 0};
+        return ctx;
+    }
+    spsc_ring<task_t>& ring(size_t from, size_t to) { return *rings_[from * shards_.size() + to]; }
+    void loop(size_t me);
+    void pin_to_core(size_t me);
+    // move overflowed tasks into rings that have room again
+    void flush(size_t me);
+    // run up to BATCH tasks from every inbox, returns how many ran
+    size_t poll(size_t me);
+    bool has_work(size_t me);
+
+private:
+    std::atomic<bool> running_;
+    bool const pin_;
+    std::vector<std::unique_ptr<shard>> shards_;
+    std::vector<std::unique_ptr<spsc_ring<task_t>>> rings_;  // [from * n + to]
+};
+
+inline shard_group::shard_group(size_t n_shards, size_t ring_capacity, bool pin)
+        : running_(false), pin_(pin) {
+    assert(n_shards > 0 && ring_capacity > 0);
+    shards_.resize(n_shards);
+    for (auto & s : shards_)
+        s.reset(new shard(n_shards));
+    // separate allocations, so rings of unrelated pairs do not share lines
+    rings_.resize(n_shards * n_shards);
+    for (auto & r : rings_)
+        r.reset(new spsc_ring<task_t>(ring_capacity));
+}
+
+inline shard_group::~shard_group() {
+    stop();
+    for (auto & s : shards_)
+        while (!s->remote.empty())
+            delete s->remote.pop();
+}
+
+inline void shard_group::start() {
+    if (running_.exchange(true))
+        return;
+    for (size_t i = 0; i < shards_.size(); i++)
+        shards_[i]->thread = std::thread(&shard_group::loop, this, i);
+}
+
+inline void shard_group::stop() {
+    if (!running_.exchange(false))
+        return;
+    for (auto & s : shards_)
+        s->wakeup.notify_all();
+    for (auto & s : shards_)
+        if (s->thread.joinable())
+            s->thread.join();
+}
+
+template<typename F, typename ...Args>
+inline void shard_group::submit_to(size_t to, F&& f, Args&& ...args) {
+    submit_to(to, std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+}
+
+template<typename F>
+inline void shard_group::submit_to(size_t to, F&& f) {
+    assert(to < shards_.size());
+    task_t task(std::forward<F>(f));
+    const shard_ctx& ctx = current();
+    if (ctx.group == this) {
+        shard& s = *shards_[ctx.index];
+        auto& pending = s.overflow[to];
+        // keep order: once something overflowed, later tasks queue behind it
+        if (pending.empty() && ring(ctx.index, to).try_push(std::move(task))) {
+            shards_[to]->wakeup.notify_one();
+            return;
+        }
+        pending.push_back(std::move(task));
+        ++s.n_overflow;
+        s.overflowing.store(true, std::memory_order_relaxed);
+        return;
+    }
+    shards_[to]->remote.push(new remote_node(std::move(task)));
+    shards_[to]->wakeup.notify_one();
+}
+
+inline void shard_group::loop(size_t me) {
+    current() = shard_ctx{this, me};
+    if (pin_)
+        pin_to_core(me);
+    shard& s = *shards_[me];
+    size_t idle = 0;
+    while (running_) {
+        if (s.n_overflow)
+            flush(me);
+        if (poll(me)) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < SPIN) {
+            cpu_relax();
+            continue;
+        }
+        // announce sleep first, then re-check inboxes so no submission is missed
+        auto key = s.wakeup.prepare_wait();
+        if (!running_ || has_work(me)) {
+            s.wakeup.cancel_wait();
+            continue;
+        }
+        s.wakeup.wait(key);
+        idle = 0;
+    }
+    current() = shard_ctx{nullptr, 0};
+}
+
+inline void shard_group::pin_to_core(size_t me) {
+#ifdef __linux__
+    size_t n_cores = std::thread::hardware_concurrency();
+    if (n_cores == 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(me % n_cores, &set);
+    // best effort, runs unpinned if the core is not allowed
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)me;
+#endif
+}
+
+inline void shard_group::flush(size_t me) {
+    shard& s = *shards_[me];
+    for (size_t to = 0; to < shards_.size(); to++) {
+        auto& pending = s.overflow[to];
+        if (pending.empty())
+            continue;
+        auto& r = ring(me, to);
+        size_t moved = 0;
+        while (!pending.empty() && r.try_push(std::move(pending.front()))) {
+            pending.pop_front();
+            ++moved;
+        }
+        if (moved) {
+            s.n_overflow -= moved;
+            shards_[to]->wakeup.notify_one();
+        }
+    }
+    if (!s.n_overflow)
+        s.overflowing.store(false, std::memory_order_relaxed);
+}
+
+inline size_t shard_group::poll(size_t me) {
+    size_t n = 0;
+    auto run = [](task_t& task) { task(); };
+    for (size_t from = 0; from < shards_.size(); from++) {
+        if (!ring(from, me).consume(run, BATCH))
+            continue;
+        n++;
+        // sender may sleep waiting for room in this ring
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (from != me && shards_[from]->overflowing.load(std::memory_order_relaxed))
+            shards_[from]->wakeup.notify_one();
+    }
+    mpsc_queue<remote_node>& remote = shards_[me]->remote;
+    for (size_t i = 0; i < BATCH; i++) {
+        std::unique_ptr<remote_node> node(remote.pop());
+        if (!node)
+            break;  // empty, or a producer still linking (has_work keeps us awake)
+        node->task();
+        n++;
+    }
+    return n;
+}
+
+inline bool shard_group::has_work(size_t me) {
+    shard& s = *shards_[me];
+    if (!s.remote.empty())
+        return true;
+    for (size_t from = 0; from < shards_.size(); from++)
+        if (!ring(from, me).empty())
+            return true;
+    if (s.n_overflow)
+        for (size_t to = 0; to < shards_.size(); to++)
+            if (!s.overflow[to].empty() && !ring(me, to).full())
+                return true;
+    return false;
+}
+
+#endif //DISPATCHER_SHARD_GROUP_H
@@ -0,0 +1,116 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_SHARDED_COUNTER_H
+#define DISPATCHER_SHARDED_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+
+// counter spread over cache line padded slots, every thread updates its own slot
+// so producers on different cores do not fight over one line, reads sum the slots
+//
+// approx() is a relaxed sum, may lag behind concurrent updates by a few
+// exact() is exact once updates have stopped; under concurrent updates it is only a
+// best-effort snapshot: it sums until two passes agree, at most MAX_PASSES times, and
+// agreeing passes may still hide updates that cancelled out in between
+class sharded_counter {
+private:
+    static constexpr size_t CACHE_LINE = 64;
+    // new ignores alignment beyond max_align_t before C++17, slots are placed by hand
+    struct slot {
+        std::atomic<int64_t> v;
+        char pad[CACHE_LINE - sizeof(std::atomic<int64_t>)];
+        slot() : v(0) {}
+    };
+
+public:
+    explicit sharded_counter(size_t n_slots = default_slots())
+            : mask_(round_up(n_slots) - 1), raw_(new char[(mask_ + 1) * sizeof(slot) + CACHE_LINE - 1]) {
+        auto addr = reinterpret_cast<uintptr_t>(raw_.get());
+        slots_ = reinterpret_cast<slot*>((addr + CACHE_LINE - 1) & ~static_cast<uintptr_t>(CACHE_LINE - 1));
+        for (size_t i = 0; i <= mask_; i++)
+            new (&slots_[i]) slot();
+    }
+    ~sharded_counter() {
+        for (size_t i = 0; i <= mask_; i++)
+            slots_[i].~slot();
+    }
+    // non-copyable
+    sharded_counter(const sharded_counter &) = delete;
+    sharded_counter& operator=(const sharded_counter &) = delete;
+
+    void add(int64_t d) { slots_[thread_index() & mask_].v.fetch_add(d, std::memory_order_relaxed); }
+    void sub(int64_t d) { add(-d); }
+    sharded_counter& operator++() { add(1); return *this; }
+    sharded_counter& operator--() { add(-1); return *this; }
+    sharded_counter& operator+=(int64_t d) { add(d); return *this; }
+    sharded_counter& operator-=(int64_t d) { add(-d); return *this; }
+
+    int64_t approx() const {
+        int64_t sum = 0;
+        for (size_t i = 0; i <= mask_; i++)
+            sum += slots_[i].v.load(std::memory_order_relaxed);
+        return sum;
+    }
+    int64_t exact() const {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t prev = collect();
+        for (size_t pass = 1; pass < MAX_PASSES; pass++) {
+            int64_t cur = collect();
+            if (cur == prev)
+                break;
+            prev = cur;
+        }
+        return prev;
+    }
+    // a decrement may be seen before its increment, never report below zero
+    operator size_t() const {
+        int64_t v = approx();
+        return v > 0 ? static_cast<size_t>(v) : 0;
+    }
+
+    void reset() {
+        for (size_t i = 0; i <= mask_; i++)
+            slots_[i].v.store(0, std::memory_order_relaxed);
+    }
+
+    static constexpr size_t MAX_PASSES = 8;
+
+    static size_t default_slots() {
+        size_t n = std::thread::hardware_concurrency();
+        return n == 0 ? 8 : (n > 64 ? 64 : n);
+    }
+
+private:
+    int64_t collect() const {
+        int64_t sum = 0;
+        for (size_t i = 0; i <= mask_; i++)
+            sum += slots_[i].v.load(std::memory_order_acquire);
+        return sum;
+    }
+    static size_t round_up(size_t n) {
+        size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+    // threads get consecutive indices on first use, spreading them over the slots
+    static size_t thread_index() {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+private:
+    size_t const mask_;
+    std::unique_ptr<char[]> raw_;  // slots_ rounded up to a cache line inside
+    slot* slots_;
+};
+
+#endif //DISPATCHER_SHARDED_COUNTER_H
@@ -0,0 +1,132 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_SPSC_RING_H
+#define DISPATCHER_SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// bounded lock-free single-producer single-consumer ring
+// producer and consumer indices live on their own cache lines, each side also keeps
+// a cached copy of the other's index so the shared line is only read when the ring
+// looks full (producer) or empty (consumer)
+template<typename T>
+class spsc_ring {
+private:
+    using storage_t = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+    static constexpr size_t LINE = 64;
+
+public:
+    // capacity is rounded up to a power of two
+    explicit spsc_ring(size_t capacity)
+            : head_(0), cached_tail_(0), tail_(0), cached_head_(0),
+              mask_(round_up(capacity) - 1), slots_(new storage_t[mask_ + 1]) {}
+    // non-copyable
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring& operator=(const spsc_ring &) = delete;
+    ~spsc_ring() {
+        for (size_t h = head_.load(std::memory_order_relaxed), t = tail_.load(std::memory_order_relaxed); h != t; h++)
+            slot(h)->~T();
+    }
+
+    // producer only, false if full
+    template<typename U>
+    bool try_push(U&& v) { return try_emplace(std::forward<U>(v)); }
+    // producer only, constructs the item in its slot, false if full
+    template<typename ...Args>
+    bool try_emplace(Args&& ...args) {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (t - cached_head_ > mask_)
+                return false;
+        }
+        new (slot(t)) T(std::forward<Args>(args)...);
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    // producer only
+    bool full() {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - cached_head_ <= mask_)
+            return false;
+        cached_head_ = head_.load(std::memory_order_acquire);
+        return t - cached_head_ > mask_;
+    }
+
+    // consumer only, false if empty
+    bool try_pop(T& out) {
+        size_t h = head_.load(std::memory_order_relaxed);
+        if (h == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (h == cached_tail_)
+                return false;
+        }
+        T* p = slot(h);
+        out = std::move(*p);
+        p->~T();
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    // consumer only, hands up to max items to f in order, returns how many
+    // every slot is released before f runs, so the producer can refill meanwhile
+    template<typename F>
+    size_t consume(F&& f, size_t max) {
+        size_t h = head_.load(std::memory_order_relaxed);
+        if (h == cached_tail_)
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+        size_t n = cached_tail_ - h;
+        if (n > max)
+            n = max;
+        for (size_t i = 0; i < n; i++, h++) {
+            T* p = slot(h);
+            T v(std::move(*p));
+            p->~T();
+            head_.store(h + 1, std::memory_order_release);
+            f(v);
+        }
+        return n;
+    }
+    // consumer only, seq_cst so a consumer going to sleep never misses a push
+    bool empty() {
+        size_t h = head_.load(std::memory_order_relaxed);
+        if (h != cached_tail_)
+            return false;
+        cached_tail_ = tail_.load(std::memory_order_seq_cst);
+        return h == cached_tail_;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    T* slot(size_t i) { return reinterpret_cast<T*>(&slots_[i & mask_]); }
+    static size_t round_up(size_t n) {
+        size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+private:
+    char pad0_[LINE];
+    // consumer side
+    std::atomic<size_t> head_;
+    size_t cached_tail_;
+    char pad1_[LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    // producer side
+    std::atomic<size_t> tail_;
+    size_t cached_head_;
+    char pad2_[LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    // read-only after construction
+    size_t const mask_;
+    std::unique_ptr<storage_t[]> slots_;
+    char pad3_[LINE - sizeof(size_t) - sizeof(std::unique_ptr<storage_t[]>)];
+};
+
+#endif //DISPATCHER_SPSC_RING_H
@@ -7,6 +7,8 @@
 
 #include "task_runner.h"
 #include <vector>
+#include <atomic>
+#include <cassert>
 
 class task_group {
 public:
@@ -32,6 +34,12 @@ public:
     void start();
     void stop();
 
+    // opt-in, call before start(): immediate tasks sent to a runner wait in a queue its
+    // idle siblings steal from (tail of the busiest one), so a slow task no longer holds
+    // up everything behind it; deferred and rate-limited tasks stay on their runner
+    void enable_stealing();
+    size_t stolen_tasks() const { return n_stolen_; }
+
     // push task for delayed execution (insert into deferred_tasks_)
     template<typename F, typename ...Args>
     void push(F&& f, time_stamp ts, Args&& ...args);
@@ -44,22 +52,36 @@ public:
     template<typename F>
     void send(F&& f);
 
+    // tasks of one key all go to the same runner, so its bucket limits the key group-wide
+    void set_rate_limit(int key, double rate, size_t burst = 1);
+    void remove_rate_limit(int key);
+    template<typename F, typename ...Args>
+    void send_limited(int key, F&& f, Args&& ...args);
+    template<typename F>
+    void send_limited(int key, F&& f);
+    size_t throttled_tasks();
+
     size_t size() { return runners.size(); }
     size_t waiting_tasks();
 
 private:
     size_t next_to();
+    size_t runner_of(int key) { return static_cast<unsigned>(key) % runners.size(); }
+    task_runner::task_node* steal_for(size_t thief);
+    bool can_steal(size_t thief);
+    void wake_idle(size_t busy);
 
 private:
     task_forward_strategy strategy_;
     size_t next_idx_;  // use atomic type if push/send used in multi-threading env
     std::vector<std::unique_ptr<task_runner>> runners;
+    std::atomic<size_t> n_stolen_;
 };
 
 inline task_group::task_group(size_t n_threads,
                               stop_mode sm,
                               task_forward_strategy strategy)
-        : strategy_(strategy), next_idx_(0) {
+        : strategy_(strategy), next_idx_(0), n_stolen_(0) {
     assert(n_threads > 0);
     runners.resize(n_threads);
     for (auto i = 0; i < n_threads; i++)
@@ -76,6 +98,13 @@ inline void task_group::stop() {
         runner->stop();
 }
 
+inline void task_group::enable_stealing() {
+    for (size_t i = 0; i < runners.size(); i++)
+        runners[i]->share_with([this, i]() { return steal_for(i); },
+                               [this, i]() { return can_steal(i); },
+                               [this, i]() { wake_idle(i); });
+}
+
 template<typename F, typename... Args>
 inline void task_group::push(F &&f, time_stamp ts, Args &&... args) {
     runners[next_to()]->push(std::forward<F>(f),
@@ -100,6 +129,77 @@ inline void task_group::send(F &&f) {
     runners[next_to()]->send(std::forward<F>(f));
 }
 
+inline void task_group::set_rate_limit(int key, double rate, size_t burst) {
+    runners[runner_of(key)]->set_rate_limit(key, rate, burst);
+}
+
+inline void task_group::remove_rate_limit(int key) {
+    runners[runner_of(key)]->remove_rate_limit(key);
+}
+
+template<typename F, typename... Args>
+inline void task_group::send_limited(int key, F &&f, Args &&... args) {
+    runners[runner_of(key)]->send_limited(key,
+                                          std::forward<F>(f),
+                                          std::forward<Args>(args)...);
+}
+
+template<typename F>
+inline void task_group::send_limited(int key, F &&f) {
+    runners[runner_of(key)]->send_limited(key, std::forward<F>(f));
+}
+
+inline size_t task_group::throttled_tasks() {
+    size_t sum = 0;
+    for (auto & runner : runners)
+        sum += runner->throttled_tasks();
+    return sum;
+}
+
+inline task_runner::task_node* task_group::steal_for(size_t thief) {
+    size_t victim = thief;
+    size_t most = 0;
+    for (size_t i = 0; i < runners.size(); i++) {
+        size_t n = runners[i]->n_shared_.load();
+        if (i != thief && n > most) {
+            most = n;
+            victim = i;
+        }
+    }
+    if (victim == thief)
+        return nullptr;
+    task_runner& v = *runners[victim];
+    task_runner::task_node* node = nullptr;
+    {
+        task_runner::locker _(v.shared_lock_);
+        if (v.shared_tasks_.empty())
+            return nullptr;
+        node = v.shared_tasks_.back();
+        v.shared_tasks_.pop_back();
+        --v.n_shared_;
+    }
+    // the task is waiting on the thief now
+    --v.n_pending_;
+    ++runners[thief]->n_pending_;
+    ++n_stolen_;
+    return node;
+}
+
+inline bool task_group::can_steal(size_t thief) {
+    for (size_t i = 0; i < runners.size(); i++)
+        if (i != thief && runners[i]->n_shared_.load())
+            return true;
+    return false;
+}
+
+// wake one sleeping sibling of busy, it steals once up
+inline void task_group::wake_idle(size_t busy) {
+    for (size_t i = 0; i < runners.size(); i++) {
+        if (i != busy && runners[i]->notify())
+            return;
+    }
+}
+
 inline size_t task_group::next_to() {
     auto n_runners = runners.size();
     switch (strategy_) {
@@ -5,190 +5,303 @@
 #ifndef DISPATCHER_TASK_RUNNER_H
 #define DISPATCHER_TASK_RUNNER_H
 
+#include <algorithm>
 #include <functional>
 #include <atomic>
-#include <thread>
-#include <map>
-#include <queue>
 #include <chrono>
+#include <deque>
 #include <mutex>
+#include <unordered_map>
+#include <cassert>
+#include <cmath>
+#include "basic_executor.h"
+
+class task_group;
+
+// single thread executor with deferred tasks (system clock, microseconds), token bucket
+// rate limits, inline dispatch and work sharing within a task_group
+using task_runner_base = basic_executor<mpsc_intake, timed_wait, function_task,
+                                        timer_clock<std::chrono::system_clock, std::chrono::microseconds>>;
+
+class task_runner : public task_runner_base {
+    using base = task_runner_base;
 
-class task_runner {
 public:
     enum class stop_mode {
-        IMMEDIATE,
-        WAIT_CURRENT_DONE,
-        WAIT_ALL_DONE
+        IMMEDIATE,          // finish the running task, the rest stays queued for restart
+        WAIT_CURRENT_DONE,  // also run every task already queued, deferred ones stay
+        WAIT_ALL_DONE       // also run every deferred task, right away
     };
-    using time_stamp = std::chrono::time_point<std::chrono::system_clock,
-            std::chrono::microseconds>;
-    static time_stamp now() {
-        return std::chrono::time_point_cast<std::chrono::microseconds>(std::chrono::system_clock::now());
-    }
+    // how the loop sleeps until the earliest deferred task
+    enum class timer_mode {
+        CONDVAR,  // condition variable timed wait
+#ifdef __linux__
+        PRECISE   // timerfd armed at the deadline (minus spin), eventfd wakeups
+#endif
+    };
+    using time_stamp = base::time_point;
 
 public:
-    explicit task_runner(stop_mode sm = stop_mode::IMMEDIATE);
+    // spin: busy-wait this last stretch before a deadline instead of sleeping through it
+    explicit task_runner(stop_mode sm = stop_mode::IMMEDIATE, timer_mode tm = timer_mode::CONDVAR,
+                         std::chrono::microseconds spin = std::chrono::microseconds(0));
     // non-copyable
     task_runner(const task_runner &) = delete;
     task_runner& operator=(const task_runner &) = delete;
     // non-movable
     task_runner(task_runner &&) = delete;
     task_runner& operator=(task_runner &&) = delete;
-    ~task_runner() { stop(); }
+    ~task_runner();
 
-    void start();
     void stop();
 
-    // push task for delayed execution (insert into deferred_tasks_)
+    // push task for delayed execution
     template<typename F, typename ...Args>
     void push(F&& f, time_stamp ts, Args&& ...args);
     template<typename F>
     void push(F&& f, time_stamp ts);
+    // same, but the task may run up to slack late, so the loop can wake once for every
+    // task whose window overlaps (like timerslack), slack of plain push is set_timer_slack(),
+    // a negative slack is taken as 0
+    template<typename F, typename ...Args>
+    void push_slack(F&& f, time_stamp ts, std::chrono::microseconds slack, Args&& ...args);
+    template<typename F>
+    void push_slack(F&& f, time_stamp ts, std::chrono::microseconds slack);
+    // default slack of later push() calls, 0 (precise) unless set; negative counts as 0
+    void set_timer_slack(std::chrono::microseconds slack) { timer_slack_ = no_earlier(slack).count(); }
 
-    // send task for immediate execution (push into tasks_)
+    // send task for immediate execution
     template<typename F, typename ...Args>
     void send(F&& f, Args&& ...args);
     template<typename F>
     void send(F&& f);
 
-    size_t waiting_tasks() { return n_waiting_tasks_; };
+    // from this runner's own thread (a task handing off more work) run f inline,
+    // nested up to MAX_INLINE_DEPTH, deeper ones are queued (no wakeup, the loop is awake);
+    // from other threads same as send
+    template<typename F, typename ...Args>
+    void dispatch(F&& f, Args&& ...args);
+    template<typename F>
+    void dispatch(F&& f);
+
+    // token bucket for tasks sent with key: rate tokens per second, at most burst saved up,
+    // replaces the former bucket of key; use a single key to limit the whole runner
+    void set_rate_limit(int key, double rate, size_t burst = 1);
+    void remove_rate_limit(int key);
+    // send, but run no sooner than key's bucket has a token, tasks over budget wait as
+    // deferred tasks until their token refills; keys without a bucket are not limited
+    template<typename F, typename ...Args>
+    void send_limited(int key, F&& f, Args&& ...args);
+    template<typename F>
+    void send_limited(int key, F&& f);
+    // tasks that had to wait for a token so far
+    size_t throttled_tasks() const { return n_throttled_; }
+    // times the loop thread blocked and woke up again
+    size_t wakeups() const { return waiter().wakeups(); }
 
-private:
-    void loop_f();
+    size_t waiting_tasks() { return pending(); };
+
+    static constexpr size_t MAX_INLINE_DEPTH = 16;
 
 private:
-    using task_t = std::function<void()>;
-    using flat_t = std::atomic<bool>;
+    friend class task_group;
     using locker = std::unique_lock<std::mutex>;
+    // token bucket as GCRA, release times follow from the theoretical arrival time
+    struct bucket {
+        std::chrono::microseconds interval;   // one token per interval
+        std::chrono::microseconds tolerance;  // (burst - 1) intervals
+        time_stamp tat;
+    };
+
+    // a task never runs before its time, so slack can only delay it
+    static std::chrono::microseconds no_earlier(std::chrono::microseconds slack) {
+        return std::max(slack, std::chrono::microseconds::zero());
+    }
+    // inline nesting of dispatch() on the current thread
+    static size_t& depth() {
+        static thread_local size_t d = 0;
+        return d;
+    }
+
+    // immediate tasks go to a deque idle siblings steal from, set up before start()
+    void share_with(std::function<task_node*()> steal, std::function<bool()> can_steal,
+                    std::function<void()> backlog);
+    void share(task_node* node);
+    // own oldest shared task, else (unless draining) one stolen from a sibling
+    task_node* take_shared(bool draining);
+    bool has_shared() const;
+    // earliest time a task of key may run, takes its token
+    time_stamp release_time(int key, time_stamp now_);
 
     stop_mode stop_mode_;
-    flat_t running_;
-    std::unique_ptr<std::thread> thread_;
-    std::multimap<time_stamp, task_t*> deferred_tasks_;
-    std::queue<task_t*> tasks_;  // push deferred_tasks into tasks_ when time arrived
-    std::atomic<size_t> n_waiting_tasks_;  // n_waiting_tasks = tasks + deferred_tasks
-    std::mutex task_lock_;
-    std::condition_variable condition_;
+    std::mutex limit_lock_;
+    std::unordered_map<int, bucket> buckets_;
+    std::atomic<size_t> n_throttled_;
+    std::atomic<int64_t> timer_slack_;  // microseconds
+    // work sharing within a task_group
+    bool sharing_;
+    std::mutex shared_lock_;
+    std::deque<task_node*> shared_tasks_;  // owner takes the front, thieves the back
+    std::atomic<size_t> n_shared_;
+    std::function<task_node*()> steal_;     // a task from the busiest sibling, or nullptr
+    std::function<bool()> can_steal_;
+    std::function<void()> backlog_;         // shared task queued while owner is awake
 };
 
-inline task_runner::task_runner(stop_mode sm)
-        : running_(false), stop_mode_(sm), n_waiting_tasks_(0) { }
+inline task_runner::task_runner(stop_mode sm, timer_mode tm, std::chrono::microseconds spin)
+        : base(1, "task_runner"), stop_mode_(sm), n_throttled_(0), timer_slack_(0),
+          sharing_(false), n_shared_(0) {
+#ifdef __linux__
+    waiter().configure(tm == timer_mode::PRECISE, spin);
+#else
+    waiter().configure(false, spin);
+#endif
+}
 
-inline void task_runner::start() {
-    running_ = true;
-    thread_.reset(new std::thread(&task_runner::loop_f, this));
+inline task_runner::~task_runner() {
+    stop();
+    for (auto node : shared_tasks_)
+        delete node;
 }
 
 inline void task_runner::stop() {
-    running_ = false;
-    if (thread_->joinable())
-        thread_->join();
+    switch (stop_mode_) {
+        case stop_mode::IMMEDIATE:
+            return base::stop(base::stop_mode::KEEP);
+        case stop_mode::WAIT_CURRENT_DONE:
+            return base::stop(base::stop_mode::FLUSH);
+        case stop_mode::WAIT_ALL_DONE:
+            return base::stop(base::stop_mode::DRAIN);
+    }
+}
+
+inline void task_runner::share_with(std::function<task_node*()> steal, std::function<bool()> can_steal,
+                                    std::function<void()> backlog) {
+    assert(!running() && "work sharing set up after start()");
+    sharing_ = true;
+    steal_ = std::move(steal);
+    can_steal_ = std::move(can_steal);
+    backlog_ = std::move(backlog);
+    set_source([this](bool draining) { return take_shared(draining); },
+               [this]() { return has_shared(); });
+}
+
+inline void task_runner::share(task_node* node) {
+    DISPATCHER_TRACE_EVENT(ENQUEUE, "task_runner", this, node);
+    {
+        locker _(shared_lock_);
+        shared_tasks_.push_back(node);
+        ++n_shared_;
+    }
+    if (!notify() && backlog_)
+        backlog_();  // owner busy, let an idle sibling come for it
+}
+
+inline task_runner::task_node* task_runner::take_shared(bool draining) {
+    {
+        locker _(shared_lock_);
+        if (!shared_tasks_.empty()) {
+            task_node* node = shared_tasks_.front();
+            shared_tasks_.pop_front();
+            --n_shared_;
+            return node;
+        }
+    }
+    return draining || !steal_ ? nullptr : steal_();
+}
+
+inline bool task_runner::has_shared() const {
+    return n_shared_.load() != 0 || (can_steal_ && can_steal_());
 }
 
 template<typename F, typename ...Args>
 inline void task_runner::push(F&& f, task_runner::time_stamp ts, Args&& ...args) {
-    if (ts <= now())
-        return send(std::forward<F>(f), std::forward<Args>(args)...);
-    ++n_waiting_tasks_;
-    auto task = new task_t(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-    locker _(task_lock_);
-    deferred_tasks_.insert(std::pair<time_stamp, task_t*>(ts, task));
-    condition_.notify_one();
+    push(std::bind(std::forward<F>(f), std::forward<Args>(args)...), ts);
 }
 
 template<typename F>
 inline void task_runner::push(F&& f, task_runner::time_stamp ts) {
+    push_slack(std::forward<F>(f), ts, std::chrono::microseconds(timer_slack_.load()));
+}
+
+template<typename F, typename ...Args>
+inline void task_runner::push_slack(F&& f, time_stamp ts, std::chrono::microseconds slack, Args&& ...args) {
+    push_slack(std::bind(std::forward<F>(f), std::forward<Args>(args)...), ts, slack);
+}
+
+template<typename F>
+inline void task_runner::push_slack(F&& f, time_stamp ts, std::chrono::microseconds slack) {
     if (ts <= now())
         return send(std::forward<F>(f));
-    ++n_waiting_tasks_;
-    auto task = new task_t(std::forward<F>(f));
-    locker _(task_lock_);
-    deferred_tasks_.insert(std::pair<time_stamp, task_t*>(ts, task));
-    condition_.notify_one();
+    execute_at(ts, no_earlier(slack), std::forward<F>(f));
 }
 
 template<typename F, typename ...Args>
 inline void task_runner::send(F&& f, Args&& ...args) {
-    ++n_waiting_tasks_;
-    auto task = new task_t(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-    locker _(task_lock_);
-    tasks_.push(task);
-    condition_.notify_one();
+    send(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
 }
 template<typename F>
 inline void task_runner::send(F&& f) {
-    ++n_waiting_tasks_;
-    auto task = new task_t(std::forward<F>(f));
-    locker _(task_lock_);
-    tasks_.push(task);
-    condition_.notify_one();
-}
-
-inline void task_runner::loop_f() {
-    std::queue<task_t*> ready_to_execute_tasks;
-    while (running_) {
-        {
-            locker locker_(task_lock_);
-            while (running_ && tasks_.empty()) {
-                // no immediate tasks, sleep 100ms
-                condition_.wait_for(locker_, std::chrono::milliseconds(100));
-                if (!deferred_tasks_.empty())
-                    break;
-            }
-            // collect immediate tasks
-            if (!tasks_.empty())
-                ready_to_execute_tasks.swap(tasks_);
-            // collect deferred tasks
-            auto next_event = time_stamp::max();
-            if (!deferred_tasks_.empty())
-                next_event = deferred_tasks_.begin()->first;
-            auto now_ = now();
-            if (next_event <= now_) {
-                auto it = deferred_tasks_.begin();
-                for (; it != deferred_tasks_.end(); ++it) {
-                    if (it->first > now_)
-                        break;
-                    ready_to_execute_tasks.push(it->second);
-                }
-                deferred_tasks_.erase(deferred_tasks_.begin(), it);
-            }
-        }
-        // execute tasks
-        // not execute if stop triggered (!running_)
-        while (running_ && !ready_to_execute_tasks.empty()) {
-            std::unique_ptr<task_t> tp(ready_to_execute_tasks.front());
-            ready_to_execute_tasks.pop();
-            --n_waiting_tasks_;
-            (*tp)();
-        }
-    }
-    // cleanup
-    // lock to not accept task any more
-    locker _(task_lock_);
-    switch (stop_mode_) {
-        case stop_mode::IMMEDIATE:
-            break;
-        case stop_mode::WAIT_CURRENT_DONE:
-            while (!ready_to_execute_tasks.empty()) {
-                std::unique_ptr<task_t> tp(ready_to_execute_tasks.front());
-                ready_to_execute_tasks.pop();
-                --n_waiting_tasks_;
-                (*tp)();
-            }
-            break;
-        case stop_mode::WAIT_ALL_DONE:
-            // collect all deferred tasks
-            for (auto & deferred_task : deferred_tasks_)
-                ready_to_execute_tasks.push(deferred_task.second);
-            deferred_tasks_.clear();
-            while (!ready_to_execute_tasks.empty()) {
-                std::unique_ptr<task_t> tp(ready_to_execute_tasks.front());
-                ready_to_execute_tasks.pop();
-                --n_waiting_tasks_;
-                (*tp)();
-            }
-            break;
-    }
+    if (sharing_)
+        share(make_node(std::forward<F>(f)));
+    else
+        execute(std::forward<F>(f));
+}
+
+template<typename F, typename ...Args>
+inline void task_runner::dispatch(F&& f, Args&& ...args) {
+    dispatch(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+}
+
+template<typename F>
+inline void task_runner::dispatch(F&& f) {
+    if (!on_worker() || depth() >= MAX_INLINE_DEPTH)
+        return send(std::forward<F>(f));
+    ++depth();
+    struct depth_guard {
+        ~depth_guard() { --depth(); }
+    } _;
+    f();
+}
+
+inline void task_runner::set_rate_limit(int key, double rate, size_t burst) {
+    assert(rate > 0 && burst > 0);
+    auto interval = std::chrono::microseconds(std::max<long long>(1, std::llround(1e6 / rate)));
+    locker _(limit_lock_);
+    buckets_[key] = bucket{interval, interval * static_cast<long long>(burst - 1), now()};
+}
+
+inline void task_runner::remove_rate_limit(int key) {
+    locker _(limit_lock_);
+    buckets_.erase(key);
+}
+
+template<typename F, typename ...Args>
+inline void task_runner::send_limited(int key, F&& f, Args&& ...args) {
+    send_limited(key, std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+}
+
+// the token is taken on send, so tasks of a key are released in send order
+template<typename F>
+inline void task_runner::send_limited(int key, F&& f) {
+    auto now_ = now();
+    auto release = release_time(key, now_);
+    if (release <= now_)
+        return execute(std::forward<F>(f));
+    // over budget, deferred until its token refills
+    ++n_throttled_;
+    execute_at(release, std::forward<F>(f));
+}
+
+inline task_runner::time_stamp task_runner::release_time(int key, time_stamp now_) {
+    locker _(limit_lock_);
+    auto it = buckets_.find(key);
+    if (it == buckets_.end())
+        return now_;
+    bucket& b = it->second;
+    time_stamp release = std::max(now_, b.tat - b.tolerance);
+    b.tat = std::max(b.tat, release) + b.interval;
+    return release;
 }
 
 #endif //DISPATCHER_TASK_RUNNER_H
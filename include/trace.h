@@ -0,0 +1,189 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_TRACE_H
+#define DISPATCHER_TRACE_H
+
+// per-task lifecycle tracing, compiled in only with DISPATCHER_TRACE defined
+// and recording only after tracer::enable(true)
+//
+// every thread writes into its own ring buffer (the oldest events get overwritten),
+// tracer::dump() writes all rings as chrome trace event json (chrome://tracing, perfetto)
+
+#ifdef DISPATCHER_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef DISPATCHER_TRACE_RING
+#define DISPATCHER_TRACE_RING (1 << 16)  // events kept per thread, power of 2
+#endif
+
+class tracer {
+public:
+    enum phase : uint8_t {
+        ENQUEUE,  // task handed to the dispatcher
+        DEQUEUE,  // task taken out of the queue by its executing thread
+        STEAL,    // task (or a batch, task is nullptr) stolen from another queue
+        START,    // task starts running
+        FINISH    // task done
+    };
+
+private:
+    struct event {
+        uint64_t ticks;
+        const void* task;
+        const void* dispatcher;
+        const char* kind;
+        phase ph;
+    };
+
+    struct ring {
+        explicit ring(size_t id) : tid(id), head(0), events(DISPATCHER_TRACE_RING) {}
+        size_t const tid;
+        std::atomic<uint64_t> head;  // only the owning thread writes
+        std::vector<event> events;
+    };
+
+    struct registry {
+        registry() : enabled(false), t0(clock_ticks()), c0(std::chrono::steady_clock::now()) {}
+        std::atomic<bool> enabled;
+        std::mutex lock;
+        std::vector<std::shared_ptr<ring>> rings;  // kept after their thread exits
+        uint64_t const t0;
+        std::chrono::steady_clock::time_point const c0;
+    };
+
+public:
+    static void enable(bool on) { instance().enabled.store(on, std::memory_order_relaxed); }
+    static bool enabled() { return instance().enabled.load(std::memory_order_relaxed); }
+
+    static void record(phase ph, const char* kind, const void* dispatcher, const void* task) {
+        if (!enabled())
+            return;
+        ring& r = local_ring();
+        uint64_t h = r.head.load(std::memory_order_relaxed);
+        event& e = r.events[h & (DISPATCHER_TRACE_RING - 1)];
+        e.ticks = clock_ticks();
+        e.task = task;
+        e.dispatcher = dispatcher;
+        e.kind = kind;
+        e.ph = ph;
+        r.head.store(h + 1, std::memory_order_release);
+    }
+
+    // drop recorded events of all threads
+    static void clear() {
+        registry& reg = instance();
+        std::lock_guard<std::mutex> _(reg.lock);
+        for (auto &r : reg.rings)
+            r->head.store(0, std::memory_order_relaxed);
+    }
+
+    // events recorded while dumping may come out torn, disable tracing first for an exact dump
+    static void dump(std::ostream& os);
+
+private:
+    static registry& instance() {
+        static registry reg;
+        return reg;
+    }
+
+    static ring& local_ring() {
+        static thread_local std::shared_ptr<ring> r;
+        if (!r) {
+            registry& reg = instance();
+            std::lock_guard<std::mutex> _(reg.lock);
+            r = std::make_shared<ring>(reg.rings.size() + 1);
+            reg.rings.push_back(r);
+        }
+        return *r;
+    }
+
+    // tsc where available, converted to wall time only when dumping
+    static uint64_t clock_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    static void write_event(std::ostream& os, bool& first, const char* name, const char* ph,
+                            double ts, size_t tid, const event& e, bool flow);
+};
+
+inline void tracer::write_event(std::ostream& os, bool& first, const char* name, const char* ph,
+                                double ts, size_t tid, const event& e, bool flow) {
+    os << (first ? "\n" : ",\n");
+    first = false;
+    os << "{\"name\":\"" << name << "\",\"cat\":\"" << e.kind << "\",\"ph\":\"" << ph << "\""
+       << ",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << tid;
+    if (flow)
+        os << ",\"id\":\"" << e.task << "\"" << (ph[0] == 'f' ? ",\"bp\":\"e\"" : "");
+    else if (ph[0] == 'i')
+        os << ",\"s\":\"t\"";
+    os << ",\"args\":{\"task\":\"" << e.task << "\",\"dispatcher\":\"" << e.dispatcher << "\"}}";
+}
+
+inline void tracer::dump(std::ostream& os) {
+    registry& reg = instance();
+    std::lock_guard<std::mutex> _(reg.lock);
+    // ticks per microsecond, measured over the whole process lifetime
+    double us = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - reg.c0).count());
+    uint64_t ticks = clock_ticks() - reg.t0;
+    double ticks_per_us = us > 0 ? static_cast<double>(ticks) / us : 1.0;
+
+    bool first = true;
+    os << "{\"traceEvents\":[";
+    for (auto &r : reg.rings) {
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t begin = head > DISPATCHER_TRACE_RING ? head - DISPATCHER_TRACE_RING : 0;
+        for (uint64_t i = begin; i < head; i++) {
+            const event& e = r->events[i & (DISPATCHER_TRACE_RING - 1)];
+            double ts = static_cast<double>(e.ticks - reg.t0) / ticks_per_us;
+            switch (e.ph) {
+                case ENQUEUE:
+                    write_event(os, first, "enqueue", "i", ts, r->tid, e, false);
+                    write_event(os, first, "queued", "s", ts, r->tid, e, true);
+                    break;
+                case DEQUEUE:
+                    write_event(os, first, "dequeue", "i", ts, r->tid, e, false);
+                    break;
+                case STEAL:
+                    write_event(os, first, "steal", "i", ts, r->tid, e, false);
+                    break;
+                case START:
+                    write_event(os, first, "queued", "f", ts, r->tid, e, true);
+                    write_event(os, first, e.kind, "B", ts, r->tid, e, false);
+                    break;
+                case FINISH:
+                    write_event(os, first, e.kind, "E", ts, r->tid, e, false);
+                    break;
+            }
+        }
+    }
+    os << "\n]}\n";
+}
+
+#define DISPATCHER_TRACE_EVENT(ph, kind, dispatcher, task) \
+    tracer::record(tracer::ph, kind, dispatcher, task)
+
+#else
+
+#define DISPATCHER_TRACE_EVENT(ph, kind, dispatcher, task) ((void)0)
+
+#endif //DISPATCHER_TRACE
+
+#endif //DISPATCHER_TRACE_H
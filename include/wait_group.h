@@ -0,0 +1,186 @@
+//
+// Created by Harold on 2026/10/19.
+//
+
+#ifndef DISPATCHER_WAIT_GROUP_H
+#define DISPATCHER_WAIT_GROUP_H
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <type_traits>
+#include <utility>
+
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// completion signal of a batch of tasks on any dispatcher, one atomic op per finished task
+//
+//     wait_group wg;
+//     for (...) pool.execute(wg.wrap(f));
+//     wg.wait();         // or pool.wait(wg) from a pool worker to help meanwhile
+//
+// waiters block until the count drops to zero, the group can be reused after that;
+// the count and a waiters flag share one word, so once the last done() took it to zero
+// it touches nothing but that word's futex, the waiter may destroy the group right away
+class wait_group {
+private:
+    static constexpr uint32_t WAITERS = uint32_t(1) << 31;
+    static constexpr uint32_t COUNT_MASK = WAITERS - 1;
+
+public:
+    explicit wait_group(size_t n = 0) : state_(static_cast<uint32_t>(n)) {
+        assert(n <= COUNT_MASK);
+    }
+    // non-copyable
+    wait_group(const wait_group &) = delete;
+    wait_group& operator=(const wait_group &) = delete;
+
+    void add(size_t n = 1) {
+        uint32_t prev = state_.fetch_add(static_cast<uint32_t>(n), std::memory_order_relaxed);
+        assert((prev & COUNT_MASK) + n <= COUNT_MASK && "wait_group count overflow");
+        (void)prev;
+    }
+    void done();
+    size_t pending() const { return state_.load(std::memory_order_acquire) & COUNT_MASK; }
+
+    void wait() const;
+    template<typename Clock, typename Duration>
+    std::future_status wait_until(const std::chrono::time_point<Clock, Duration>& deadline) const;
+    // future-like, so helping waits such as defer_pool::wait() take a wait_group too
+    template<typename Rep, typename Period>
+    std::future_status wait_for(const std::chrono::duration<Rep, Period>& d) const {
+        if (pending() == 0)
+            return std::future_status::ready;
+        return wait_until(std::chrono::steady_clock::now() + d);
+    }
+
+    // f counted into the group, done() once it returns (or throws)
+    template<typename F>
+    class wrapped {
+    public:
+        wrapped(F f, wait_group* wg) : f_(std::move(f)), wg_(wg) {}
+        template<typename ...Args>
+        void operator()(Args&& ...args) {
+            struct done_guard {
+                wait_group* wg;
+                ~done_guard() { wg->done(); }
+            } _{wg_};
+            f_(std::forward<Args>(args)...);
+        }
+    private:
+        F f_;
+        wait_group* wg_;
+    };
+    // adds one right away, so a wrapped task that never runs keeps the group from draining
+    template<typename F>
+    wrapped<typename std::decay<F>::type> wrap(F&& f) {
+        add();
+        return wrapped<typename std::decay<F>::type>(std::forward<F>(f), this);
+    }
+
+private:
+#ifdef __linux__
+    int* futex_addr() const { return reinterpret_cast<int*>(const_cast<std::atomic<uint32_t>*>(&state_)); }
+#else
+    void done_locked();
+#endif
+
+private:
+    mutable std::atomic<uint32_t> state_;  // pending count, WAITERS once someone blocks
+#ifndef __linux__
+    // WAITERS set under lock_ and the last done() of a watched group counts down under it,
+    // a waiter only returns after taking lock_, so after the notifier let go of it
+    mutable std::mutex lock_;
+    mutable std::condition_variable drained_;
+#endif
+};
+
+// the last one clears WAITERS along with the count, so a reused group starts unwatched
+inline void wait_group::done() {
+    uint32_t cur = state_.load(std::memory_order_relaxed);
+    while (true) {
+        assert((cur & COUNT_MASK) > 0 && "wait_group::done() called more often than add()");
+        bool last = (cur & COUNT_MASK) == 1;
+#ifndef __linux__
+        if (last && (cur & WAITERS))
+            return done_locked();
+#endif
+        if (state_.compare_exchange_weak(cur, last ? 0 : cur - 1, std::memory_order_acq_rel,
+                                         std::memory_order_relaxed))
+            break;
+    }
+#ifdef __linux__
+    // a wake by address only, harmless even if the waiter is gone and the word reused
+    if ((cur & COUNT_MASK) == 1 && (cur & WAITERS))
+        syscall(SYS_futex, futex_addr(), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+#ifdef __linux__
+inline void wait_group::wait() const {
+    uint32_t cur = state_.load(std::memory_order_acquire);
+    while ((cur & COUNT_MASK) != 0) {
+        if (!(cur & WAITERS) && !state_.compare_exchange_weak(cur, cur | WAITERS, std::memory_order_acquire))
+            continue;
+        syscall(SYS_futex, futex_addr(), FUTEX_WAIT_PRIVATE, static_cast<int>(cur | WAITERS),
+                nullptr, nullptr, 0);
+        cur = state_.load(std::memory_order_acquire);
+    }
+}
+
+template<typename Clock, typename Duration>
+inline std::future_status wait_group::wait_until(const std::chrono::time_point<Clock, Duration>& deadline) const {
+    uint32_t cur = state_.load(std::memory_order_acquire);
+    while ((cur & COUNT_MASK) != 0) {
+        auto left = deadline - Clock::now();
+        if (left <= Duration::zero())
+            return std::future_status::timeout;  // WAITERS stays, the last done() clears it
+        if (!(cur & WAITERS) && !state_.compare_exchange_weak(cur, cur | WAITERS, std::memory_order_acquire))
+            continue;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        timespec ts{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+        syscall(SYS_futex, futex_addr(), FUTEX_WAIT_PRIVATE, static_cast<int>(cur | WAITERS),
+                &ts, nullptr, 0);
+        cur = state_.load(std::memory_order_acquire);
+    }
+    return std::future_status::ready;
+}
+#else
+inline void wait_group::done_locked() {
+    std::lock_guard<std::mutex> _(lock_);
+    uint32_t cur = state_.load(std::memory_order_relaxed);
+    // add() may still race in, only a count of one ends here
+    while (!state_.compare_exchange_weak(cur, (cur & COUNT_MASK) == 1 ? 0 : cur - 1,
+                                         std::memory_order_acq_rel, std::memory_order_relaxed)) { }
+    if ((cur & COUNT_MASK) == 1)
+        drained_.notify_all();
+}
+
+inline void wait_group::wait() const {
+    std::unique_lock<std::mutex> locker_(lock_);
+    state_.fetch_or(WAITERS, std::memory_order_acquire);
+    drained_.wait(locker_, [this]() { return pending() == 0; });
+}
+
+template<typename Clock, typename Duration>
+inline std::future_status wait_group::wait_until(const std::chrono::time_point<Clock, Duration>& deadline) const {
+    std::unique_lock<std::mutex> locker_(lock_);
+    state_.fetch_or(WAITERS, std::memory_order_acquire);
+    bool ready = drained_.wait_until(locker_, deadline, [this]() { return pending() == 0; });
+    return ready ? std::future_status::ready : std::future_status::timeout;
+}
+#endif
+
+#endif //DISPATCHER_WAIT_GROUP_H
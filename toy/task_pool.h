@@ -10,7 +10,11 @@
 #include <functional>
 #include <atomic>
 #include <memory>
-#include <cstdio>
+#include <cassert>
+#include <cstdint>
+#include "event_count.h"
+#include "sharded_counter.h"
+#include "trace.h"
 
 #ifdef USE_SIMPLE_QUEUE
 #include "wsq.h"
@@ -24,9 +28,21 @@ class task_pool {
 public:
     using task_t = std::function<void()>;
     using flag_t = std::atomic<bool>;
+    // what an idle worker does after a failed round of stealing, in order
+    struct idle_strategy {
+        size_t spins;   // rounds separated by a cpu pause
+        size_t yields;  // rounds separated by std::this_thread::yield()
+        bool park;      // then sleep until next push
+    };
 
 public:
-    explicit task_pool(size_t n_threads): next_idx_(0), qs_(n_threads), n_threads_(n_threads), n_waiting_tasks_(0) {
+    explicit task_pool(size_t n_threads): task_pool(n_threads, idle_strategy{64, 16, true}) {}
+    task_pool(size_t n_threads, idle_strategy idle)
+        : idle_(idle), next_idx_(0), qs_(n_threads),
+#ifndef USE_SIMPLE_QUEUE
+                                          locals_(n_threads),
+#endif
+                                          n_threads_(n_threads) {
         assert(n_threads > 0);
         threads_.reserve(n_threads);
         threads_stop_flags_.resize(n_threads);
@@ -37,51 +53,143 @@ public:
     }
     ~task_pool() {
         // simply wait for all tasks done
-        while (n_waiting_tasks_ != 0) { }
+        while (!drained())
+            std::this_thread::yield();
         for (auto i = 0; i < n_threads_; i++) {
             *threads_stop_flags_[i] = true;
         }
+        parked_.notify_all();
         for (auto & thread : threads_)
             thread.join();
     }
     template<typename F>
     void push(F&& f) {
-        ++n_waiting_tasks_;
-        qs_[next_idx_++ % n_threads_].push(new task_t(std::forward<F>(f)));
+        ++n_pushed_;
+        auto tp = new task_t(std::forward<F>(f));
+        DISPATCHER_TRACE_EVENT(ENQUEUE, "task_pool", this, tp);
+        qs_[next_idx_++ % n_threads_].push(tp);
+        parked_.notify_one();
     }
 
 private:
+    idle_strategy const idle_;
+    event_count parked_;
     std::vector<std::thread> threads_;
     std::vector<std::shared_ptr<flag_t>> threads_stop_flags_;
     std::vector<wsq<task_t*>> qs_;
+#ifndef USE_SIMPLE_QUEUE
+    // qs_ are owned by the pushing thread, each worker owns its local deque
+    std::vector<wsq<task_t*>> locals_;
+#endif
     std::atomic<size_t> next_idx_;
     size_t const n_threads_;
-    std::atomic<size_t> n_waiting_tasks_;
+    // both only grow, so a quiet pool can be told apart from a racy sum, see drained()
+    sharded_counter n_pushed_;
+    sharded_counter n_done_;
 
 private:
+    // cap of tasks moved by one steal
+    static constexpr size_t MAX_STEAL = 256;
+
+    // deque worker i pops from
+    wsq<task_t*>& own(size_t i) {
+#ifdef USE_SIMPLE_QUEUE
+        return qs_[i];
+#else
+        return locals_[i];
+#endif
+    }
+
+    // move a batch from victim v into own deque of worker i
+    size_t steal_from(size_t i, size_t v) {
+        size_t n = 0;
+#ifdef USE_SIMPLE_QUEUE
+        // my simple wsq based on lock is ok for pop in the same deque
+        if (v != i)
+            n = qs_[v].steal_batch(own(i), MAX_STEAL);
+#else
+        // _wsq requires push and pop in the same thread
+        // so tasks pushed to qs_ always get stolen, own one included
+        n = qs_[v].steal_batch(own(i), MAX_STEAL);
+        if (n == 0 && v != i)
+            n = locals_[v].steal_batch(own(i), MAX_STEAL);
+#endif
+        return n;
+    }
+
+    // all pushed tasks finished, once no outside thread pushes any more;
+    // the done sum is read first and can only be low, the pushed sum after it can only
+    // be high, so them being equal means every task pushed by then had finished
+    bool drained() const {
+        int64_t done = n_done_.exact();
+        return n_pushed_.exact() == done;
+    }
+
+    // any task left to run or steal
+    bool has_tasks() {
+        for (size_t v = 0; v < n_threads_; v++) {
+            if (!qs_[v].empty())
+                return true;
+#ifndef USE_SIMPLE_QUEUE
+            if (!locals_[v].empty())
+                return true;
+#endif
+        }
+        return false;
+    }
+
     void loop_f(size_t i) {
-        while (!*threads_stop_flags_[i]) {
+        // xorshift64 per worker, so thieves do not all start at the same victim
+        uint64_t rnd = 0x9E3779B97F4A7C15ull * (i + 1);
+        size_t idle_rounds = 0;
+        flag_t& stop = *threads_stop_flags_[i];
+        while (!stop) {
             task_t* tp = nullptr;
-#ifdef USE_SIMPLE_QUEUE
-            // _wsq requires push and pop in the same thread
-            // my simple wsq based on lock is ok for both
             // fetch task from its own queue
-            if (qs_[i].pop(tp) && tp) {
+            if (own(i).pop(tp) && tp) {
+                DISPATCHER_TRACE_EVENT(DEQUEUE, "task_pool", this, tp);
+                DISPATCHER_TRACE_EVENT(START, "task_pool", this, tp);
                 (*tp)();
-                --n_waiting_tasks_;
+                DISPATCHER_TRACE_EVENT(FINISH, "task_pool", this, tp);
+                // tasks it pushed are counted before it is, for drained()
+                std::atomic_thread_fence(std::memory_order_release);
+                ++n_done_;
                 delete tp;
+                idle_rounds = 0;
                 continue;
             }
-#endif
-            // steal task from other threads
-            for (auto j = 0; j < n_threads_; j++)
-                if (qs_[(i+j) % n_threads_].steal(tp) && tp) {
-                    printf("%zu steal from %lu\n", i, (i+j) % n_threads_);
-                    (*tp)();
-                    --n_waiting_tasks_;
-                    delete tp;
+            // steal half of a random victim's tasks, then run them from own queue
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 7;
+            rnd ^= rnd << 17;
+            bool stolen = false;
+            for (size_t j = 0, first = rnd % n_threads_; j < n_threads_; j++) {
+                size_t v = (first + j) % n_threads_;
+                size_t n = steal_from(i, v);
+                if (n != 0) {
+                    DISPATCHER_TRACE_EVENT(STEAL, "task_pool", this, nullptr);
+                    stolen = true;
                     break;
                 }
+            }
+            if (stolen) {
+                idle_rounds = 0;
+                continue;
+            }
+            // nothing found, back off: spin, then yield, then park
+            ++idle_rounds;
+            if (idle_rounds <= idle_.spins) {
+                cpu_relax();
+            } else if (idle_rounds <= idle_.spins + idle_.yields || !idle_.park) {
+                std::this_thread::yield();
+            } else {
+                auto key = parked_.prepare_wait();
+                if (stop || has_tasks())
+                    parked_.cancel_wait();
+                else
+                    parked_.wait(key);
+                idle_rounds = 0;
+            }
         }
     }
 };
@@ -7,6 +7,7 @@
 
 #include <queue>
 #include <mutex>
+#include <vector>
 
 // simple toy work steal queue
 template<typename T>
@@ -44,6 +45,24 @@ public:
         q_.pop_back();
         return true;
     }
+    // steal up to half (at most max) at back into out, returns number moved
+    size_t steal_batch(wsq& out, size_t max) {
+        std::vector<T> batch;
+        {
+            locker locker_(lock_, std::try_to_lock);
+            if (!locker_ || q_.empty())
+                return 0;
+            size_t n = (q_.size() + 1) / 2;
+            if (n > max)
+                n = max;
+            batch.assign(q_.end() - n, q_.end());
+            q_.erase(q_.end() - n, q_.end());
+        }
+        locker _(out.lock_);
+        // keep oldest at back of out as well
+        out.q_.insert(out.q_.end(), batch.begin(), batch.end());
+        return batch.size();
+    }
 
 private:
     std::deque<T> q_;
@@ -3,6 +3,7 @@
 //
 
 #include <thread>
+#include <cstdio>
 #include "_wsq.h"
 
 int main() {
@@ -49,5 +50,18 @@ int main() {
     thief1.join();
     thief2.join();
 
+    // a burst grows the array, low occupancy afterwards shrinks it back
+    for(int i=0; i<100000; i++)
+        queue.push(i);
+    printf("capacity after burst: %lld\n", (long long)queue.capacity());
+    int item;
+    while(queue.pop(item)) { }
+    for(int i=0; i<100000; i++) {
+        queue.push(i);
+        queue.pop(item);
+    }
+    printf("capacity after drain: %lld, retired arrays kept: %zu\n",
+           (long long)queue.capacity(), queue.garbage());
+
     return 0;
 }
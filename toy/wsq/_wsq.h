@@ -11,6 +11,8 @@
 #include <atomic>
 #include <vector>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 
 /**
 @class: WorkStealingQueue
@@ -25,6 +27,12 @@ available at https://www.di.ens.fr/~zappa/readings/ppopp13.pdf.
 
 Only the queue owner can perform pop and push operations,
 while others can steal data from the queue.
+
+Unlike the paper, top and bottom are packed into one 64-bit anchor
+(bottom in the high half, top in the low half, both wrapping at 2^32).
+The owner pops with a CAS on the anchor instead of a store and a fence,
+which lets a thief claim a batch of items with a single CAS without
+racing the owner for the ones in the middle.
 */
 template <typename T>
 class WorkStealingQueue {
@@ -58,9 +66,11 @@ class WorkStealingQueue {
             return S[i & M].load(std::memory_order_relaxed);
         }
 
-        Array* resize(int64_t b, int64_t t) {
-            Array* ptr = new Array {2*C};
-            for(int64_t i=t; i!=b; ++i) {
+        // copies the n items starting at t, indices wrap with the anchor
+        // but C divides 2^32 so i & M still picks the same slot
+        Array* resize(int64_t n, int64_t t, int64_t c) {
+            Array* ptr = new Array {c};
+            for(int64_t i=t; i!=t+n; ++i) {
                 ptr->push(i, pop(i));
             }
             return ptr;
@@ -68,10 +78,31 @@ class WorkStealingQueue {
 
     };
 
-    std::atomic<int64_t> _top;
-    std::atomic<int64_t> _bottom;
+    // consecutive owner operations with occupancy below 1/4 before halving the array
+    static constexpr int64_t SHRINK_STREAK = 128;
+
+    std::atomic<uint64_t> _anchor;
     std::atomic<Array*> _array;
     std::vector<Array*> _garbage;
+    // thieves currently inside steal(), retired arrays are freed
+    // only when the owner sees none after swapping _array
+    std::atomic<int64_t> _thieves;
+    int64_t _min_capacity;
+    int64_t _low_streak;
+
+    static uint32_t _top_of(uint64_t a) noexcept { return static_cast<uint32_t>(a); }
+    static uint32_t _bottom_of(uint64_t a) noexcept { return static_cast<uint32_t>(a >> 32); }
+    static int64_t _size_of(uint64_t a) noexcept {
+        return static_cast<uint32_t>(_bottom_of(a) - _top_of(a));
+    }
+    static uint64_t _pack(uint32_t b, uint32_t t) noexcept {
+        return (static_cast<uint64_t>(b) << 32) | t;
+    }
+
+    void _retire(Array* old, Array* a);
+    void _reclaim();
+    Array* _reserve(uint64_t anchor, int64_t n);
+    Array* _shrink(Array* a, uint64_t anchor, int64_t reserved = 0);
 
 public:
 
@@ -102,12 +133,18 @@ public:
     */
     int64_t capacity() const noexcept;
 
+    /**
+    @brief queries the number of retired arrays not reclaimed yet
+    */
+    size_t garbage() const noexcept;
+
     /**
     @brief inserts an item to the queue
 
     Only the owner thread can insert an item to the queue.
     The operation can trigger the queue to resize its capacity
-    if more space is required.
+    if more space is required, or to halve it if occupancy stayed
+    below a quarter for a while.
 
     @tparam O data type
 
@@ -131,16 +168,29 @@ public:
     The return can be a @std_nullopt if this operation failed (not necessary empty).
     */
     bool steal(T&);
+
+    /**
+    @brief steals up to half of the items into another queue
+
+    Any threads can try to steal, but only the owner of @p out may call it
+    with that queue. Claims up to max(1, size/2) items (capped by @p max)
+    with a single CAS and pushes them into @p out.
+
+    @return number of items moved, 0 if this operation failed (not necessary empty)
+    */
+    size_t steal_batch(WorkStealingQueue& out, size_t max);
 };
 
 // Constructor
 template <typename T>
 WorkStealingQueue<T>::WorkStealingQueue(int64_t c) {
     assert(c && (!(c & (c-1))));
-    _top.store(0, std::memory_order_relaxed);
-    _bottom.store(0, std::memory_order_relaxed);
+    _anchor.store(0, std::memory_order_relaxed);
     _array.store(new Array{c}, std::memory_order_relaxed);
     _garbage.reserve(32);
+    _thieves.store(0, std::memory_order_relaxed);
+    _min_capacity = c;
+    _low_streak = 0;
 }
 
 // Destructor
@@ -155,92 +205,104 @@ WorkStealingQueue<T>::~WorkStealingQueue() {
 // Function: empty
 template <typename T>
 bool WorkStealingQueue<T>::empty() const noexcept {
-    int64_t b = _bottom.load(std::memory_order_relaxed);
-    int64_t t = _top.load(std::memory_order_relaxed);
-    return b <= t;
+    return _size_of(_anchor.load(std::memory_order_relaxed)) == 0;
 }
 
 // Function: size
 template <typename T>
 size_t WorkStealingQueue<T>::size() const noexcept {
-    int64_t b = _bottom.load(std::memory_order_relaxed);
-    int64_t t = _top.load(std::memory_order_relaxed);
-    return static_cast<size_t>(b >= t ? b - t : 0);
+    return static_cast<size_t>(_size_of(_anchor.load(std::memory_order_relaxed)));
 }
 
 // Function: push
 template <typename T>
 template <typename O>
 void WorkStealingQueue<T>::push(O&& o) {
-    int64_t b = _bottom.load(std::memory_order_relaxed);
-    int64_t t = _top.load(std::memory_order_acquire);
-    Array* a = _array.load(std::memory_order_relaxed);
-
-    // queue is full
-    if(a->capacity() - 1 < (b - t)) {
-        Array* tmp = a->resize(b, t);
-        _garbage.push_back(a);
-        std::swap(a, tmp);
-        _array.store(a, std::memory_order_relaxed);
-    }
+    uint64_t anchor = _anchor.load(std::memory_order_acquire);
+    Array* a = _reserve(anchor, 1);
 
-    a->push(b, std::forward<O>(o));
-    std::atomic_thread_fence(std::memory_order_release);
-    _bottom.store(b + 1, std::memory_order_relaxed);
+    a->push(_bottom_of(anchor), std::forward<O>(o));
+    // thieves may move top meanwhile, add to bottom only
+    _anchor.fetch_add(uint64_t(1) << 32, std::memory_order_release);
 }
 
 // Function: pop
 template <typename T>
 bool WorkStealingQueue<T>::pop(T& item) {
-    int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
-    Array* a = _array.load(std::memory_order_relaxed);
-    _bottom.store(b, std::memory_order_relaxed);
-    std::atomic_thread_fence(std::memory_order_seq_cst);
-    int64_t t = _top.load(std::memory_order_relaxed);
-
-    bool ret = true;
+    uint64_t anchor = _anchor.load(std::memory_order_acquire);
+    Array* a = _shrink(_array.load(std::memory_order_relaxed), anchor);
 
-    if(t <= b) {
+    while(_size_of(anchor) != 0) {
+        uint32_t b = _bottom_of(anchor) - 1;
         item = a->pop(b);
-        if(t == b) {
-            // the last item just got stolen
-            if(!_top.compare_exchange_strong(t, t+1,
-                                             std::memory_order_seq_cst,
-                                             std::memory_order_relaxed)) {
-                // fail race
-                ret = false;
-            }
-            _bottom.store(b + 1, std::memory_order_relaxed);
+        if(_anchor.compare_exchange_weak(anchor, _pack(b, _top_of(anchor)),
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_acquire)) {
+            return true;
         }
+        // thieves moved top, retry
     }
-    else {
-        // empty queue
-        ret = false;
-        _bottom.store(b + 1, std::memory_order_relaxed);
-    }
-    return ret;
+    // empty queue
+    return false;
 }
 
 // Function: steal
 template <typename T>
 bool WorkStealingQueue<T>::steal(T& item) {
-    int64_t t = _top.load(std::memory_order_acquire);
-    std::atomic_thread_fence(std::memory_order_seq_cst);
-    int64_t b = _bottom.load(std::memory_order_acquire);
-
-    if(t < b) {
-        Array* a = _array.load(std::memory_order_consume);
+    uint64_t anchor = _anchor.load(std::memory_order_acquire);
+
+    bool ret = false;
+    if(_size_of(anchor) != 0) {
+        uint32_t t = _top_of(anchor);
+        // announce before touching _array so the owner keeps it alive
+        _thieves.fetch_add(1, std::memory_order_seq_cst);
+        Array* a = _array.load(std::memory_order_seq_cst);
         item = a->pop(t);
-        if(!_top.compare_exchange_strong(t, t+1,
-                                         std::memory_order_seq_cst,
-                                         std::memory_order_relaxed)) {
-            // fail race
-            return false;
-        }
-        return true;
+        // fail race if cas failed
+        ret = _anchor.compare_exchange_strong(anchor, _pack(_bottom_of(anchor), t + 1),
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_relaxed);
+        _thieves.fetch_sub(1, std::memory_order_release);
     }
 
-    return false;
+    return ret;
+}
+
+// Function: steal_batch
+template <typename T>
+size_t WorkStealingQueue<T>::steal_batch(WorkStealingQueue& out, size_t max) {
+    assert(&out != this);
+    uint64_t anchor = _anchor.load(std::memory_order_acquire);
+    int64_t n = (_size_of(anchor) + 1) / 2;
+    if(n > static_cast<int64_t>(max)) {
+        n = static_cast<int64_t>(max);
+    }
+    if(n == 0) {
+        return 0;
+    }
+
+    // copy straight into the unpublished slots above out's bottom
+    uint64_t out_anchor = out._anchor.load(std::memory_order_acquire);
+    Array* dst = out._reserve(out_anchor, n);
+    uint32_t ob = _bottom_of(out_anchor);
+    uint32_t t = _top_of(anchor);
+
+    _thieves.fetch_add(1, std::memory_order_seq_cst);
+    Array* a = _array.load(std::memory_order_seq_cst);
+    for(int64_t i=0; i<n; ++i) {
+        dst->push(ob + i, a->pop(t + i));
+    }
+    bool ret = _anchor.compare_exchange_strong(anchor, _pack(_bottom_of(anchor), t + n),
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_relaxed);
+    _thieves.fetch_sub(1, std::memory_order_release);
+
+    if(!ret) {
+        // fail race
+        return 0;
+    }
+    out._anchor.fetch_add(static_cast<uint64_t>(n) << 32, std::memory_order_release);
+    return static_cast<size_t>(n);
 }
 
 // Function: capacity
@@ -249,4 +311,78 @@ int64_t WorkStealingQueue<T>::capacity() const noexcept {
     return _array.load(std::memory_order_relaxed)->capacity();
 }
 
+// Function: garbage
+template <typename T>
+size_t WorkStealingQueue<T>::garbage() const noexcept {
+    return _garbage.size();
+}
+
+// Function: _retire
+// owner only, swaps in the new array and tries to free the retired ones
+template <typename T>
+void WorkStealingQueue<T>::_retire(Array* old, Array* a) {
+    _garbage.push_back(old);
+    _array.store(a, std::memory_order_seq_cst);
+    _reclaim();
+}
+
+// Function: _reclaim
+// a thief still holding a retired array has announced itself before the
+// _array store above, so seeing no thieves afterwards means nobody can
+template <typename T>
+void WorkStealingQueue<T>::_reclaim() {
+    if(_garbage.empty() || _thieves.load(std::memory_order_seq_cst) != 0) {
+        return;
+    }
+    for(auto g : _garbage) {
+        delete g;
+    }
+    _garbage.clear();
+}
+
+// Function: _reserve
+// owner only, makes room for n more items above bottom
+template <typename T>
+typename WorkStealingQueue<T>::Array*
+WorkStealingQueue<T>::_reserve(uint64_t anchor, int64_t n) {
+    Array* a = _array.load(std::memory_order_relaxed);
+    int64_t size = _size_of(anchor);
+
+    // queue is full
+    if(a->capacity() - n < size) {
+        int64_t c = a->capacity();
+        while(c - n < size) {
+            c *= 2;
+        }
+        Array* tmp = a->resize(size, _top_of(anchor), c);
+        _retire(a, tmp);
+        return tmp;
+    }
+    return _shrink(a, anchor, n);
+}
+
+// Function: _shrink
+// owner only, halves the array once occupancy stayed low for a while,
+// counting the reserved slots about to be filled as occupied
+template <typename T>
+typename WorkStealingQueue<T>::Array*
+WorkStealingQueue<T>::_shrink(Array* a, uint64_t anchor, int64_t reserved) {
+    _reclaim();
+    int64_t c = a->capacity();
+    int64_t size = _size_of(anchor);
+    if(c <= _min_capacity || 4 * (size + reserved) >= c) {
+        _low_streak = 0;
+        return a;
+    }
+    if(++_low_streak < SHRINK_STREAK) {
+        return a;
+    }
+    _low_streak = 0;
+    // thieves only move top forward, so the items left plus the reserved ones
+    // always fit in c/2 > 2*(size + reserved)
+    Array* tmp = a->resize(size, _top_of(anchor), c / 2);
+    _retire(a, tmp);
+    return tmp;
+}
+
 #endif //DISPATCHER__WSQ_H